@@ -0,0 +1,193 @@
+#include "dataset_index.h"
+#include "image_management.h"
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+	// read the whole file into 'bytes'
+	void readBytes(const string & path, vector<uchar> & bytes)
+	{
+		std::ifstream f(path.c_str(), std::ios::binary);
+		if(!f.is_open())
+			throw aia::error(aia::strprintf("in DatasetIndex: cannot open file at \"%s\"", path.c_str()));
+		f.seekg(0, std::ios::end);
+		bytes.resize(size_t(f.tellg()));
+		f.seekg(0, std::ios::beg);
+		if(!bytes.empty())
+			f.read(reinterpret_cast<char*>(&bytes[0]), bytes.size());
+		if(!f)
+			throw aia::error(aia::strprintf("in DatasetIndex: cannot read file at \"%s\"", path.c_str()));
+	}
+
+	// strip 'suffix' from the end of 'stem', if present
+	string stripSuffix(const string & stem, const string & suffix)
+	{
+		if(!suffix.empty() && aia::hasEnding(stem, suffix))
+			return stem.substr(0, stem.size() - suffix.size());
+		return stem;
+	}
+}
+
+ucas::uint64 DatasetIndex::Checksum(const vector<uchar> & bytes)
+{
+	ucas::uint64 h = 14695981039346656037ULL;
+	for(size_t i = 0; i < bytes.size(); i++)
+	{
+		h ^= bytes[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+DatasetIndex::DatasetIndex(string images_folder, string masks_folder, string ext, string mask_ext, string mask_suffix, bool strict)
+{
+	if(mask_ext.empty())
+		mask_ext = ext;
+
+	// masks by stem
+	map<string, string> masks;
+	vector<string> mask_files = ImageManagement::ListInDir(masks_folder, mask_ext);
+	for(auto & f : mask_files)
+	{
+		string stem = stripSuffix(ucas::getFileName(f, false), mask_suffix);
+		if(masks.count(stem))
+			throw aia::error(aia::strprintf("in DatasetIndex(): more than one mask matches \"%s\"", stem.c_str()));
+		masks[stem] = f;
+	}
+
+	vector<string> image_files = ImageManagement::ListInDir(images_folder, ext);
+	for(auto & f : image_files)
+	{
+		DatasetItem item;
+		item.stem = ucas::getFileName(f, false);
+		item.image_path = f;
+
+		map<string, string>::iterator m = masks.find(item.stem);
+		if(m == masks.end())
+		{
+			string msg = aia::strprintf("in DatasetIndex(): no mask found for image \"%s\"", f.c_str());
+			if(strict)
+				throw aia::error(msg);
+			aia::warning(msg.c_str());
+			continue;
+		}
+		item.mask_path = m->second;
+		items.push_back(item);
+	}
+
+	// files are read and hashed on the global pool; the first read error is rethrown here
+	ucas::ThreadPool::global().parallel_for(ucas::interval<int>(int(items.size())), [this](ucas::interval<int> r)
+	{
+		vector<uchar> bytes;
+		for(int i = r.start; i < r.end; i++)
+		{
+			DatasetItem & item = items[i];
+			readBytes(item.image_path, bytes);
+			item.image_bytes = bytes.size();
+			item.image_checksum = Checksum(bytes);
+			readBytes(item.mask_path, bytes);
+			item.mask_bytes = bytes.size();
+			item.mask_checksum = Checksum(bytes);
+		}
+	}, 1);
+	std :: cout << "Indexed " << items.size() << " image/mask pairs" << std :: endl;
+}
+
+DatasetIndex DatasetIndex::Open(string manifest_path)
+{
+	std::ifstream f(manifest_path.c_str());
+	if(!f.is_open())
+		throw aia::error(aia::strprintf("in DatasetIndex::Open(): cannot open manifest at \"%s\"", manifest_path.c_str()));
+
+	DatasetIndex index;
+	string line;
+	while(std::getline(f, line))
+	{
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		std::stringstream ss(line);
+		DatasetItem item;
+		string image_bytes, mask_bytes, image_checksum, mask_checksum;
+		std::getline(ss, item.stem, '\t');
+		std::getline(ss, item.image_path, '\t');
+		std::getline(ss, item.mask_path, '\t');
+		std::getline(ss, image_bytes, '\t');
+		std::getline(ss, mask_bytes, '\t');
+		std::getline(ss, image_checksum, '\t');
+		if(!std::getline(ss, mask_checksum, '\t'))
+			throw aia::error(aia::strprintf("in DatasetIndex::Open(): cannot parse line \"%s\"", line.c_str()));
+		item.image_bytes = aia::str2num<size_t>(image_bytes);
+		item.mask_bytes = aia::str2num<size_t>(mask_bytes);
+		item.image_checksum = aia::str2num<ucas::uint64>(image_checksum);
+		item.mask_checksum = aia::str2num<ucas::uint64>(mask_checksum);
+		index.items.push_back(item);
+	}
+	return index;
+}
+
+void DatasetIndex::Save(string manifest_path) const
+{
+	std::ofstream f(manifest_path.c_str());
+	if(!f.is_open())
+		throw aia::error(aia::strprintf("in DatasetIndex::Save(): cannot open manifest at \"%s\"", manifest_path.c_str()));
+
+	f << "# stem\timage\tmask\timage_bytes\tmask_bytes\timage_checksum\tmask_checksum\n";
+	for(auto & item : items)
+		f << item.stem << "\t" << item.image_path << "\t" << item.mask_path << "\t"
+		  << item.image_bytes << "\t" << item.mask_bytes << "\t"
+		  << item.image_checksum << "\t" << item.mask_checksum << "\n";
+}
+
+void DatasetIndex::Load(size_t i, cv::Mat & image, cv::Mat & mask, bool force_gray) const
+{
+	const DatasetItem & item = items.at(i);
+
+	// read each file once, verify it and decode from memory
+	vector<uchar> bytes;
+	readBytes(item.image_path, bytes);
+	if(bytes.size() != item.image_bytes || Checksum(bytes) != item.image_checksum)
+		throw aia::error(aia::strprintf("in DatasetIndex::Load(): image \"%s\" changed since indexing", item.image_path.c_str()));
+	image = cv::imdecode(bytes, force_gray ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_UNCHANGED);
+
+	readBytes(item.mask_path, bytes);
+	if(bytes.size() != item.mask_bytes || Checksum(bytes) != item.mask_checksum)
+		throw aia::error(aia::strprintf("in DatasetIndex::Load(): mask \"%s\" changed since indexing", item.mask_path.c_str()));
+	mask = cv::imdecode(bytes, CV_LOAD_IMAGE_GRAYSCALE);
+
+	if(!image.data || !mask.data)
+		throw aia::error(aia::strprintf("in DatasetIndex::Load(): cannot decode \"%s\"", item.stem.c_str()));
+	if(image.size() != mask.size())
+		throw aia::error(aia::strprintf("in DatasetIndex::Load(): image and mask sizes differ for \"%s\"", item.stem.c_str()));
+}
+
+DatasetIndex DatasetIndex::Shard(int k, int n) const
+{
+	if(n < 1 || k < 0 || k >= n)
+		throw aia::error(aia::strprintf("in DatasetIndex::Shard(): invalid shard %d/%d", k, n));
+
+	DatasetIndex shard;
+	for(size_t i = k; i < items.size(); i += n)
+		shard.items.push_back(items[i]);
+	return shard;
+}
+
+DatasetIndex DatasetIndex::Slice(size_t first, size_t count) const
+{
+	DatasetIndex slice;
+	for(size_t i = first; i < items.size() && i - first < count; i++)
+		slice.items.push_back(items[i]);
+	return slice;
+}
+
+void DatasetIndex::Shuffle(unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::shuffle(items.begin(), items.end(), rng);
+}
@@ -0,0 +1,63 @@
+#ifndef _Dataset_Index_h
+#define _Dataset_Index_h
+
+#include "aia/aiaConfig.h"
+#include "ucas/ucasConfig.h"
+
+using namespace std;
+
+// an image / FOV mask pair, matched by file stem
+struct DatasetItem
+{
+	string stem;						// image file name without extension
+	string image_path;
+	string mask_path;
+	size_t image_bytes;					// file sizes at indexing time
+	size_t mask_bytes;
+	ucas::uint64 image_checksum;		// FNV-1a of the file contents at indexing time
+	ucas::uint64 mask_checksum;
+
+	DatasetItem() : image_bytes(0), mask_bytes(0), image_checksum(0), mask_checksum(0){}
+};
+
+// Index of a paired image / mask dataset (DRIVE, STARE, HRF, ...). Files are
+// matched by stem once, when the index is built, and pixels are decoded only
+// when an item is loaded, so the index can be sharded, shuffled, saved and
+// resumed without touching the image data.
+class DatasetIndex
+{
+public:
+	// pair every '*<ext>' image in 'images_folder' with the '<stem><mask_suffix>*<mask_ext>' mask in 'masks_folder'
+	// if 'strict', a missing mask is an error, otherwise the image is dropped with a warning
+	// every file is read once to be checksummed (in parallel): save the index and Open() it to skip this pass
+	DatasetIndex(string images_folder, string masks_folder, string ext, string mask_ext = "", string mask_suffix = "_mask", bool strict = true);
+
+	// reload an index previously written with Save()
+	static DatasetIndex Open(string manifest_path);
+	void Save(string manifest_path) const;
+
+	size_t Size() const { return items.size(); }
+	const DatasetItem & Item(size_t i) const { return items.at(i); }
+
+	// decode image and mask of the i-th item, checking the files did not change since indexing
+	void Load(size_t i, cv::Mat & image, cv::Mat & mask, bool force_gray = false) const;
+
+	// the k-th of n interleaved shards
+	DatasetIndex Shard(int k, int n) const;
+
+	// items [first, first+count), e.g. to resume an interrupted run
+	DatasetIndex Slice(size_t first, size_t count = size_t(-1)) const;
+
+	// reproducible in-place shuffle
+	void Shuffle(unsigned int seed);
+
+	// FNV-1a checksum of a byte buffer
+	static ucas::uint64 Checksum(const vector<uchar> & bytes);
+
+private:
+	DatasetIndex(){}
+
+	vector<DatasetItem> items;
+};
+
+#endif
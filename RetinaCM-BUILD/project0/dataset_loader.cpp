@@ -0,0 +1,91 @@
+#include "dataset_loader.h"
+#include "image_management.h"
+#include <iostream>
+
+using namespace std;
+
+DatasetLoader::DatasetLoader(string folder, string ext, bool force_gray, int n_threads, int _prefetch)
+	: flags(force_gray ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_UNCHANGED), next_to_decode(0), next_to_deliver(0), stop(false)
+{
+	files = ImageManagement::ListInDir(folder, ext);
+
+	if(n_threads < 1)
+		n_threads = 1;
+	prefetch = _prefetch > 0 ? size_t(_prefetch) : size_t(2 * n_threads);
+
+	// no point in spawning more workers than files
+	if(size_t(n_threads) > files.size())
+		n_threads = int(files.size());
+	for(int t = 0; t < n_threads; t++)
+		workers.push_back(std::thread(&DatasetLoader::Worker, this));
+}
+
+DatasetLoader::~DatasetLoader(void)
+{
+	{
+		std::unique_lock<std::mutex> lk(lock);
+		stop = true;
+	}
+	can_decode.notify_all();
+	for(auto & w : workers)
+		w.join();
+}
+
+void DatasetLoader::Worker()
+{
+	for(;;)
+	{
+		size_t idx;
+		{
+			std::unique_lock<std::mutex> lk(lock);
+			can_decode.wait(lk, [this]{
+				return stop || next_to_decode >= files.size() || next_to_decode < next_to_deliver + prefetch;
+			});
+			if(stop || next_to_decode >= files.size())
+				return;
+			idx = next_to_decode++;
+		}
+
+		cv::Mat img;
+		try{
+			img = cv::imread(files[idx], flags);
+		}
+		catch(const std::exception& e){
+			std::cout << "DatasetLoader ERROR : " << e.what() << std::endl;
+		}
+
+		{
+			std::unique_lock<std::mutex> lk(lock);
+			if(img.data)
+				ready[idx] = img;
+			else
+				failed[idx] = files[idx];
+		}
+		decoded.notify_all();
+	}
+}
+
+bool DatasetLoader::Next(cv::Mat & image, string * path)
+{
+	std::unique_lock<std::mutex> lk(lock);
+	if(next_to_deliver >= files.size())
+		return false;
+
+	size_t idx = next_to_deliver;
+	decoded.wait(lk, [this, idx]{ return ready.count(idx) || failed.count(idx); });
+
+	next_to_deliver++;
+	can_decode.notify_all();
+
+	if(failed.count(idx))
+	{
+		failed.erase(idx);
+		throw aia::error(aia::strprintf("in DatasetLoader::Next(): cannot decode image at \"%s\"", files[idx].c_str()));
+	}
+
+	image = ready[idx];
+	ready.erase(idx);
+	if(path)
+		*path = files[idx];
+	return true;
+}
@@ -0,0 +1,48 @@
+#ifndef _Dataset_Loader_h
+#define _Dataset_Loader_h
+
+#include "aia/aiaConfig.h"
+#include "ucas/ucasConfig.h"
+#include <map>
+
+using namespace std;
+
+// Streams the images of a folder to the caller in file order. Decoding runs on
+// a set of worker threads that stay at most 'prefetch' images ahead of the
+// consumer, so decode overlaps with processing and peak memory is bounded by
+// the prefetch window instead of the dataset size.
+class DatasetLoader
+{
+public:
+	DatasetLoader(string folder, string ext, bool force_gray, int n_threads = ucas::THREADS_CONCURRENCY, int prefetch = -1);
+	~DatasetLoader(void);
+
+	// blocks until the next image is decoded, returns false when the dataset is exhausted
+	bool Next(cv::Mat & image, string * path = 0);
+
+	// number of files matched in the folder
+	size_t Size() const { return files.size(); }
+
+private:
+	DatasetLoader(const DatasetLoader &);
+	DatasetLoader & operator=(const DatasetLoader &);
+
+	void Worker();
+
+	vector<string> files;				// files to decode, in delivery order
+	int flags;							// cv::imread flags
+	size_t prefetch;					// max number of images decoded ahead of the consumer
+
+	map<size_t, cv::Mat> ready;			// decoded images waiting to be delivered
+	map<size_t, string> failed;			// files that could not be decoded
+	size_t next_to_decode;				// next file index claimed by a worker
+	size_t next_to_deliver;				// next file index handed to the consumer
+	bool stop;
+
+	std::mutex lock;
+	std::condition_variable can_decode;	// signaled when the consumer frees a slot
+	std::condition_variable decoded;	// signaled when a worker stores an image
+	vector<std::thread> workers;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "gabor_bank.h"
+#include "response_blender.h"
+#include <map>
+#include <tuple>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GABOR_SSE2
+#endif
+
+using namespace std;
+
+namespace
+{
+	// process-wide kernel cache (map nodes are stable, so references stay valid)
+	std::mutex cache_lock;
+	std::map<GaborParams, vector<cv::Mat> > cache;
+
+	// acc[x] += k * s[x], x in [0, n)
+	inline void axpy(float * acc, const float * s, float k, int n)
+	{
+		int x = 0;
+#ifdef GABOR_SSE2
+		__m128 kv = _mm_set1_ps(k);
+		for(; x <= n - 4; x += 4)
+			_mm_storeu_ps(acc + x, _mm_add_ps(_mm_loadu_ps(acc + x), _mm_mul_ps(kv, _mm_loadu_ps(s + x))));
+#endif
+		for(; x < n; x++)
+			acc[x] += k * s[x];
+	}
+}
+
+bool GaborParams::operator<(const GaborParams & p) const
+{
+	return std::tie(ksize.width, ksize.height, sigma, lambda, gamma, psi, orientations) <
+	       std::tie(p.ksize.width, p.ksize.height, p.sigma, p.lambda, p.gamma, p.psi, p.orientations);
+}
+
+const vector<cv::Mat> & GaborBank::GetKernels(const GaborParams & p)
+{
+	std::unique_lock<std::mutex> lk(cache_lock);
+
+	std::map<GaborParams, vector<cv::Mat> >::iterator it = cache.find(p);
+	if(it != cache.end())
+		return it->second;
+
+	// orientations are sampled as in the original pipeline (i*3.14/n)
+	vector<cv::Mat> & kernels = cache[p];
+	for(int i = 0; i < p.orientations; i++)
+		kernels.push_back(cv::getGaborKernel(p.ksize, p.sigma, i*3.14/p.orientations, p.lambda, p.gamma, p.psi, CV_32F));
+	return kernels;
+}
+
+GaborBank::GaborBank(const GaborParams & params, GaborMode requested) : scales(1, params)
+{
+	Init(requested);
+}
+
+GaborBank::GaborBank(const vector<GaborParams> & _scales, GaborMode requested) : scales(_scales)
+{
+	Init(requested);
+}
+
+void GaborBank::Init(GaborMode requested)
+{
+	if(scales.empty())
+		throw aia::error("in GaborBank(): no scales given");
+
+	top = left = bottom = right = 0;
+	int max_area = 0;
+	for(auto & p : scales)
+	{
+		if(p.orientations < 1)
+			throw aia::error(aia::strprintf("in GaborBank(): invalid number of orientations (%d)", p.orientations));
+		const vector<cv::Mat> & K = GetKernels(p);
+		for(auto & k : K)
+		{
+			kernels.push_back(k);
+			top    = std::max(top,    k.rows/2);
+			left   = std::max(left,   k.cols/2);
+			bottom = std::max(bottom, k.rows - 1 - k.rows/2);
+			right  = std::max(right,  k.cols - 1 - k.cols/2);
+			max_area = std::max(max_area, k.rows * k.cols);
+		}
+	}
+	if(kernels.size() > 256)
+		throw aia::error(aia::strprintf("in GaborBank(): too many kernels (%d), argmax is stored on 8 bits", int(kernels.size())));
+
+	// direct correlation costs O(taps) per pixel, the FFT O(log(pixels)) per pixel and kernel
+	if(requested == GABOR_AUTO)
+		mode = max_area > FFT_MIN_KERNEL_AREA ? GABOR_FFT : GABOR_DIRECT;
+	else
+		mode = requested;
+}
+
+void GaborBank::Pad(const cv::Mat & src, cv::Size size)
+{
+	// float copy of the input with reflected borders (cv::BORDER_DEFAULT, as cv::filter2D), zeros beyond
+	const int w = src.cols + left + right, h = src.rows + top + bottom;
+	padded.create(size, CV_32F);
+	xmap.resize(w);
+	for(int x = 0; x < w; x++)
+		xmap[x] = cv::borderInterpolate(x - left, src.cols, cv::BORDER_REFLECT_101);
+	for(int y = 0; y < size.height; y++)
+	{
+		float * p = padded.ptr<float>(y);
+		if(y >= h)
+		{
+			std::fill(p, p + size.width, 0.0f);
+			continue;
+		}
+		int sy = cv::borderInterpolate(y - top, src.rows, cv::BORDER_REFLECT_101);
+		if(src.depth() == CV_8U)
+		{
+			const uchar * s = src.ptr<uchar>(sy);
+			for(int x = 0; x < w; x++)
+				p[x] = s[xmap[x]];
+		}
+		else
+		{
+			const float * s = src.ptr<float>(sy);
+			for(int x = 0; x < w; x++)
+				p[x] = s[xmap[x]];
+		}
+		std::fill(p + w, p + size.width, 0.0f);
+	}
+}
+
+void GaborBank::Apply(const cv::Mat & src, cv::Mat & max_resp, cv::Mat * mean_resp, cv::Mat * argmax)
+{
+	if(src.channels() != 1 || (src.depth() != CV_8U && src.depth() != CV_32F))
+		throw aia::error("in GaborBank::Apply(): only 8-bit and 32-bit float single channel images are supported");
+
+	max_resp.create(src.size(), CV_32F);
+	if(mean_resp)
+		mean_resp->create(src.size(), CV_32F);
+	if(argmax)
+		argmax->create(src.size(), CV_8U);
+
+	if(mode == GABOR_FFT)
+		ApplyFFT(src, max_resp, mean_resp, argmax);
+	else
+		ApplyDirect(src, max_resp, mean_resp, argmax);
+}
+
+void GaborBank::ApplyDirect(const cv::Mat & src, cv::Mat & max_resp, cv::Mat * mean_resp, cv::Mat * argmax)
+{
+	const int n = src.cols, nk = int(kernels.size());
+	Pad(src, cv::Size(src.cols + left + right, src.rows + top + bottom));
+
+	// one row at a time: every kernel is applied into the same row buffer and folded right away
+	acc.resize(3 * size_t(n));
+	float * r = &acc[0], * sum_row = r + n, * arg_row = sum_row + n;
+	for(int y = 0; y < src.rows; y++)
+	{
+		float * mx = max_resp.ptr<float>(y);
+		std::fill(mx, mx + n, -std::numeric_limits<float>::max());
+		std::fill(sum_row, sum_row + 2*n, 0.0f);
+
+		for(int k = 0; k < nk; k++)
+		{
+			const cv::Mat & K = kernels[k];
+			const int oy = y + top - K.rows/2, ox = left - K.cols/2;
+			std::fill(r, r + n, 0.0f);
+			for(int i = 0; i < K.rows; i++)
+			{
+				const float * s = padded.ptr<float>(oy + i) + ox;
+				const float * kr = K.ptr<float>(i);
+				for(int j = 0; j < K.cols; j++)
+					axpy(r, s + j, kr[j], n);
+			}
+			ResponseBlender::AccumulateRow(r, mx, mean_resp ? sum_row : 0, argmax ? arg_row : 0, float(k), n);
+		}
+
+		if(mean_resp)
+		{
+			float * mean = mean_resp->ptr<float>(y);
+			for(int x = 0; x < n; x++)
+				mean[x] = sum_row[x] / nk;
+		}
+		if(argmax)
+		{
+			uchar * a = argmax->ptr<uchar>(y);
+			for(int x = 0; x < n; x++)
+				a[x] = uchar(arg_row[x]);
+		}
+	}
+}
+
+void GaborBank::ApplyFFT(const cv::Mat & src, cv::Mat & max_resp, cv::Mat * mean_resp, cv::Mat * argmax)
+{
+	const int nk = int(kernels.size());
+
+	// large enough for a linear (not circular) correlation
+	const cv::Size need(src.cols + left + right, src.rows + top + bottom);
+	const cv::Size dsize(cv::getOptimalDFTSize(need.width), cv::getOptimalDFTSize(need.height));
+
+	// kernel spectra depend on the transform size only: same-sized images reuse them
+	if(dsize != spectra_size)
+	{
+		spectra.resize(nk);
+		for(int k = 0; k < nk; k++)
+		{
+			const cv::Mat & K = kernels[k];
+			const int oy = top - K.rows/2, ox = left - K.cols/2;
+			cv::Mat kp = cv::Mat::zeros(dsize, CV_32F);
+			cv::Mat roi = kp(cv::Rect(ox, oy, K.cols, K.rows));
+			K.copyTo(roi);
+			cv::dft(kp, spectra[k], 0, oy + K.rows);
+		}
+		spectra_size = dsize;
+	}
+
+	// one forward transform of the image for the whole bank
+	Pad(src, dsize);
+	cv::dft(padded, image_spectrum, 0, need.height);
+
+	blender.Reset(src.size(), mean_resp != 0, argmax != 0);
+
+	// correlation = product with the conjugate kernel spectrum; fold each response as soon as it is back
+	for(int k = 0; k < nk; k++)
+	{
+		cv::mulSpectrums(image_spectrum, spectra[k], product, 0, true);
+		cv::dft(product, response, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE, src.rows);
+		blender.Accumulate(response(cv::Rect(0, 0, src.cols, src.rows)), k);
+	}
+
+	blender.Max().copyTo(max_resp);
+	if(mean_resp)
+		blender.Mean(*mean_resp);
+	if(argmax)
+		blender.Argmax(*argmax);
+}
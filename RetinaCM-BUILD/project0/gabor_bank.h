@@ -0,0 +1,84 @@
+#ifndef _Gabor_Bank_h
+#define _Gabor_Bank_h
+
+#include "aia/aiaConfig.h"
+#include "ucas/ucasConfig.h"
+#include "response_blender.h"
+
+using namespace std;
+
+// parameters of a bank of Gabor kernels at evenly spaced orientations
+struct GaborParams
+{
+	cv::Size ksize;
+	double sigma, lambda, gamma, psi;
+	int orientations;
+
+	GaborParams(cv::Size _ksize = cv::Size(9,7), double _sigma = 3.95, double _lambda = 7.2, double _gamma = 4, double _psi = 0, int _orientations = 8)
+		: ksize(_ksize), sigma(_sigma), lambda(_lambda), gamma(_gamma), psi(_psi), orientations(_orientations){}
+
+	// strict ordering, so that parameters can key the kernel cache
+	bool operator<(const GaborParams & p) const;
+};
+
+// how the bank filters the image
+enum GaborMode
+{
+	GABOR_AUTO,							// pick DIRECT or FFT from the kernel size
+	GABOR_DIRECT,						// spatial correlation, all kernels in one pass
+	GABOR_FFT							// one forward transform, one product and inverse transform per kernel
+};
+
+// Gabor filter bank over one or more scales. Kernels are built once per
+// parameter set and shared through a process-wide cache. Small kernels are
+// evaluated in the spatial domain, all of them in a single pass keeping
+// per-row accumulators only; large kernels are applied in the frequency
+// domain against spectra precomputed for the image size. In both modes the
+// responses are reduced on the fly to what the blending needs (max, mean,
+// argmax), so no full-frame response is stored per kernel.
+class GaborBank
+{
+public:
+	GaborBank(const GaborParams & params = GaborParams(), GaborMode mode = GABOR_AUTO);
+	GaborBank(const vector<GaborParams> & scales, GaborMode mode = GABOR_AUTO);
+
+	// filter 'src' (8-bit or 32-bit float, single channel) with every kernel (correlation, reflected border, like cv::filter2D)
+	// - max_resp:  per-pixel maximum response (CV_32F)
+	// - mean_resp: per-pixel mean response (CV_32F, optional)
+	// - argmax:    index of the kernel giving the maximum, scale-major (CV_8U, optional)
+	void Apply(const cv::Mat & src, cv::Mat & max_resp, cv::Mat * mean_resp = 0, cv::Mat * argmax = 0);
+
+	const vector<GaborParams> & Scales() const { return scales; }
+	const vector<cv::Mat> & Kernels() const { return kernels; }
+
+	// mode actually used by Apply()
+	GaborMode Mode() const { return mode; }
+
+	// CV_32F kernels for the given parameters, built on first use
+	static const vector<cv::Mat> & GetKernels(const GaborParams & params);
+
+	// in GABOR_AUTO mode, kernels with more taps than this are applied in the frequency domain
+	static const int FFT_MIN_KERNEL_AREA = 15*15;
+
+private:
+	void Init(GaborMode requested);
+	void Pad(const cv::Mat & src, cv::Size size);
+	void ApplyDirect(const cv::Mat & src, cv::Mat & max_resp, cv::Mat * mean_resp, cv::Mat * argmax);
+	void ApplyFFT(const cv::Mat & src, cv::Mat & max_resp, cv::Mat * mean_resp, cv::Mat * argmax);
+
+	vector<GaborParams> scales;
+	vector<cv::Mat> kernels;			// all scales, scale-major (data owned by the cache)
+	GaborMode mode;
+	int top, left, bottom, right;		// border needed by the largest kernel
+
+	cv::Mat padded;						// input converted to float with reflected borders
+	vector<int> xmap;					// column map used to build the borders
+	vector<float> acc;					// row buffers of the direct mode
+
+	cv::Size spectra_size;				// DFT size the kernel spectra were computed for
+	vector<cv::Mat> spectra;			// kernel spectra (FFT mode)
+	cv::Mat image_spectrum, product, response;
+	ResponseBlender blender;			// running max / sum / argmax (FFT mode)
+};
+
+#endif
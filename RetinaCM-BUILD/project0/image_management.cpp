@@ -1,5 +1,7 @@
 
 #include "image_management.h"
+#include "dataset_loader.h"
+#include "response_blender.h"
 #include "aia/aiaConfig.h"
 #include "ucas/ucasConfig.h"
 #include <iostream>
@@ -15,7 +17,7 @@ ImageManagement::~ImageManagement(void)
 {
 }
 
-std::vector<cv::Mat> ImageManagement :: LoadAllInDir(std::string folder, std::string ext, bool force_gray)
+std::vector<std::string> ImageManagement :: ListInDir(std::string folder, std::string ext)
 {
 	 //check folders exist
 		if(!ucas::isDirectory(folder))
@@ -30,36 +32,140 @@ std::vector<cv::Mat> ImageManagement :: LoadAllInDir(std::string folder, std::st
 			std::cout << e.what() <<std::endl;
 		}
 
-		//// open files that contains 'ext'
-		std::vector < cv::Mat > images;
+		//// keep files that contains 'ext'
+		std::vector < std::string > paths;
 		for(auto & f : files)
 		{
 			if(f.find(ext) == std::string::npos)
 				continue;
 
-			images.push_back(cv::imread(f, force_gray ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_UNCHANGED));
+			paths.push_back(f);
+		}
+		return paths;
+}
+
+std::vector<cv::Mat> ImageManagement :: LoadAllInDir(std::string folder, std::string ext, bool force_gray)
+{
+		// decode in parallel, but keep every image since the caller asked for all of them
+		DatasetLoader loader(folder, ext, force_gray);
+
+		// as with cv::imread, a file that cannot be decoded yields an empty image
+		std::vector < cv::Mat > images;
+		images.reserve(loader.Size());
+		for(;;)
+		{
+			cv::Mat img;
+			try{
+				if(!loader.Next(img))
+					break;
+			}
+			catch(aia::error & ex){
+				std::cout << ex.what() << std::endl;
+			}
+			images.push_back(img);
 		}
+
 		std :: cout << "Loaded " << images.size() << " from dataset" << std :: endl;
 		return images;
 
 }
-std::vector<cv::Mat> ImageManagement :: ApplyMasks(vector<cv::Mat> images, vector<cv::Mat> masks){
+std::vector<cv::Mat> ImageManagement :: ApplyMasks(const vector<cv::Mat> & images, const vector<cv::Mat> & masks){
 	
 	if(images.size() != masks.size()) throw std::runtime_error("ApplyMasks: The number of images and masks is not the same");
-	try
+
+	// one copy per image, then zero the background in place
+	std::vector<cv::Mat> result(images.size());
+	for(unsigned int i = 0; i < images.size(); i++){
+		result[i] = images[i].clone();
+		ApplyMask(result[i], masks[i]);
+	}
+	std :: cout << "Applied Masks to " << images.size() << " images" << std :: endl;
+	return result;
+}
+
+void ImageManagement :: ApplyMasksInPlace(vector<cv::Mat> & images, const vector<cv::Mat> & masks){
+	
+	if(images.size() != masks.size()) throw std::runtime_error("ApplyMasksInPlace: The number of images and masks is not the same");
+
+	for(unsigned int i = 0; i < images.size(); i++)
+		ApplyMask(images[i], masks[i]);
+}
+
+void ImageManagement :: ApplyMask(cv::Mat & image, const cv::Mat & mask){
+
+	if(image.size() != mask.size()) throw std::runtime_error("ApplyMask: image and mask sizes differ");
+	if(mask.type() != CV_8UC1) throw std::runtime_error("ApplyMask: mask must be a 8-bit single channel image");
+
+	const size_t esz = image.elemSize();
+	for(int y = 0; y < image.rows; y++){
+		uchar * p = image.ptr<uchar>(y);
+		const uchar * m = mask.ptr<uchar>(y);
+		for(int x = 0; x < image.cols; x++)
+			if(!m[x])
+				memset(p + x*esz, 0, esz);
+	}
+}
+
+namespace
+{
+	// dst(x,y) = mask(x,y) ? src(x,y)[channel] : 0, reading src and writing dst once
+	template <typename T>
+	void extractMaskedChannel(const cv::Mat & src, const cv::Mat & mask, int channel, cv::Mat & dst)
 	{
-		std::vector<cv::Mat> result;
-		for(unsigned int i = 0; i < images.size(); i++){
-			cv::Mat img;
-			result.push_back(img);
-			images[i].copyTo(result[i], masks[i]);
-		
-			std :: cout << "Applied Masks to " << images.size() << " images" << std :: endl;
-			return result;
+		const int cn = src.channels();
+		for(int y = 0; y < src.rows; y++){
+			const T * s = src.ptr<T>(y) + channel;
+			T * d = dst.ptr<T>(y);
+			if(mask.data){
+				const uchar * m = mask.ptr<uchar>(y);
+				for(int x = 0; x < src.cols; x++, s += cn)
+					d[x] = m[x] ? *s : T(0);
+			}
+			else
+				for(int x = 0; x < src.cols; x++, s += cn)
+					d[x] = *s;
 		}
 	}
-	catch(exception e){
-		std::cout << "Apply Masks of ImageManagement ERROR : "<< e.what() << std :: endl;
-		throw e;
+}
+
+void ImageManagement :: ExtractMaskedChannel(const cv::Mat & src, const cv::Mat & mask, int channel, cv::Mat & dst){
+
+	if(channel < 0 || channel >= src.channels()) throw std::runtime_error("ExtractMaskedChannel: channel out of range");
+	if(mask.data && mask.size() != src.size()) throw std::runtime_error("ExtractMaskedChannel: image and mask sizes differ");
+	if(mask.data && mask.type() != CV_8UC1) throw std::runtime_error("ExtractMaskedChannel: mask must be a 8-bit single channel image");
+	if(dst.data == src.data) throw std::runtime_error("ExtractMaskedChannel: cannot extract in place");
+
+	// no-op if the caller's buffer already has the right size and type
+	dst.create(src.size(), CV_MAKETYPE(src.depth(), 1));
+
+	switch(src.depth()){
+		case CV_8U:  extractMaskedChannel<uchar>(src, mask, channel, dst); break;
+		case CV_16U: extractMaskedChannel<ushort>(src, mask, channel, dst); break;
+		case CV_32F: extractMaskedChannel<float>(src, mask, channel, dst); break;
+		default: throw std::runtime_error("ExtractMaskedChannel: unsupported bitdepth");
 	}
-}
\ No newline at end of file
+}
+
+std::vector<cv::Mat> ImageManagement :: ExtractChanell(const vector<cv::Mat> & images, int channel){
+
+	std::vector<cv::Mat> result(images.size());
+	for(unsigned int i = 0; i < images.size(); i++)
+		ExtractMaskedChannel(images[i], cv::Mat(), channel, result[i]);
+	return result;
+}
+
+cv::Mat ImageManagement :: BlendImages(const vector<cv::Mat> & images, bool mean){
+
+	if(images.empty()) throw std::runtime_error("BlendImages: no images to blend");
+
+	ResponseBlender blender;
+	blender.Reset(images[0].size(), mean, false);
+	for(unsigned int i = 0; i < images.size(); i++)
+		blender.Accumulate(images[i]);
+
+	if(!mean)
+		return blender.Max();
+	cv::Mat result;
+	blender.Mean(result);
+	return result;
+}
@@ -11,8 +11,21 @@ class ImageManagement
 public:
 	ImageManagement(void);
 	~ImageManagement(void);
+	static vector<string> ListInDir(string folder, string ext);
 	static vector<cv::Mat> LoadAllInDir(string folder, string ext, bool force_gray);
-	static vector<cv::Mat> ApplyMasks(vector<cv::Mat> images, vector<cv::Mat> masks);
+	static vector<cv::Mat> ApplyMasks(const vector<cv::Mat> & images, const vector<cv::Mat> & masks);
+
+	// zero the pixels outside the (8-bit) mask, without allocating
+	static void ApplyMask(cv::Mat & image, const cv::Mat & mask);
+	static void ApplyMasksInPlace(vector<cv::Mat> & images, const vector<cv::Mat> & masks);
+
+	// masking fused with channel extraction: reads src once and writes the masked plane once
+	// (dst is reused when it already has the right size and type; an empty mask disables masking)
+	static void ExtractMaskedChannel(const cv::Mat & src, const cv::Mat & mask, int channel, cv::Mat & dst);
+	static vector<cv::Mat> ExtractChanell(const vector<cv::Mat> & images, int channel);
+
+	// per-pixel maximum (or mean) of CV_32F responses, folded one response at a time
+	static cv::Mat BlendImages(const vector<cv::Mat> & images, bool mean = false);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "preprocessing.h"
+#include "image_management.h"
+#include <opencv2/photo/photo.hpp>
+
+using namespace std;
+
+Preprocessor::Preprocessor(int _channel, float _h, int _template_size, int _search_size, double clip_limit)
+	: channel(_channel), h(_h), template_size(_template_size), search_size(_search_size), clahe(clip_limit)
+{
+}
+
+const cv::Mat & Preprocessor::Apply(const cv::Mat & src, const cv::Mat & mask)
+{
+	if(src.depth() != CV_8U)
+		throw aia::error("in Preprocessor::Apply(): only 8-bit images are supported");
+
+	ImageManagement::ExtractMaskedChannel(src, mask, channel, plane);
+	cv::fastNlMeansDenoising(plane, out, h, template_size, search_size);
+	clahe.apply(out, out, mask);
+
+	return out;
+}
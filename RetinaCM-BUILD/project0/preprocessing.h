@@ -0,0 +1,38 @@
+#ifndef _Preprocessing_h
+#define _Preprocessing_h
+
+#include "aia/aiaConfig.h"
+#include "ucas/ucasConfig.h"
+
+using namespace std;
+
+// Fundus preprocessing stage: FOV masking + channel extraction, non-local
+// means denoising and CLAHE. Masking and extraction are fused in one pass
+// into a persistent plane; denoising runs once on the full frame, where
+// OpenCV spreads it over its own worker threads (NL-means is nearly all of
+// the cost, so splitting it into tiles with halos only adds work). CLAHE
+// equalizes within the FOV mask, if any, so the black background does not
+// skew the histograms of the border tiles. The plane and output buffers are
+// kept across calls, but NL-means still allocates its bordered copy of the
+// plane on every call.
+class Preprocessor
+{
+public:
+	Preprocessor(int channel = 1, float h = 3.0f, int template_size = 7, int search_size = 21, double clip_limit = 4.0);
+
+	// 'src' is an 8-bit image, 'mask' an optional 8-bit FOV mask
+	// the returned plane is owned by the preprocessor and overwritten by the next call
+	const cv::Mat & Apply(const cv::Mat & src, const cv::Mat & mask);
+
+private:
+	int channel;						// channel to extract (1 = green)
+	float h;							// NL-means filter strength
+	int template_size;					// NL-means template window
+	int search_size;					// NL-means search window
+
+	ucas::CLAHE clahe;					// tiled CLAHE, with its own persistent workspace
+	cv::Mat plane;						// masked channel
+	cv::Mat out;						// denoised and equalized plane
+};
+
+#endif
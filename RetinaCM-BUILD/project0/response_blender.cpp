@@ -0,0 +1,118 @@
+#include "response_blender.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLENDER_SSE2
+#endif
+
+using namespace std;
+
+namespace
+{
+	// mx = max(mx, r)
+	inline void maxRow(const float * r, float * mx, int n)
+	{
+		int x = 0;
+#ifdef BLENDER_SSE2
+		for(; x <= n - 4; x += 4)
+			_mm_storeu_ps(mx + x, _mm_max_ps(_mm_loadu_ps(r + x), _mm_loadu_ps(mx + x)));
+#endif
+		for(; x < n; x++)
+			mx[x] = r[x] > mx[x] ? r[x] : mx[x];
+	}
+
+	// mx = max(mx, r), arg = index where r is the new maximum
+	inline void maxArgRow(const float * r, float * mx, float * arg, float index, int n)
+	{
+		int x = 0;
+#ifdef BLENDER_SSE2
+		__m128 iv = _mm_set1_ps(index);
+		for(; x <= n - 4; x += 4)
+		{
+			__m128 v = _mm_loadu_ps(r + x), m = _mm_loadu_ps(mx + x);
+			__m128 gt = _mm_cmpgt_ps(v, m);
+			_mm_storeu_ps(mx + x, _mm_or_ps(_mm_and_ps(gt, v), _mm_andnot_ps(gt, m)));
+			_mm_storeu_ps(arg + x, _mm_or_ps(_mm_and_ps(gt, iv), _mm_andnot_ps(gt, _mm_loadu_ps(arg + x))));
+		}
+#endif
+		for(; x < n; x++)
+			if(r[x] > mx[x])
+			{
+				mx[x] = r[x];
+				arg[x] = index;
+			}
+	}
+
+	// sum += r
+	inline void sumRow(const float * r, float * sum, int n)
+	{
+		int x = 0;
+#ifdef BLENDER_SSE2
+		for(; x <= n - 4; x += 4)
+			_mm_storeu_ps(sum + x, _mm_add_ps(_mm_loadu_ps(sum + x), _mm_loadu_ps(r + x)));
+#endif
+		for(; x < n; x++)
+			sum[x] += r[x];
+	}
+}
+
+void ResponseBlender::AccumulateRow(const float * r, float * mx, float * sum, float * arg, float index, int n)
+{
+	if(arg)
+		maxArgRow(r, mx, arg, index, n);
+	else
+		maxRow(r, mx, n);
+	if(sum)
+		sumRow(r, sum, n);
+}
+
+ResponseBlender::ResponseBlender() : track_mean(false), track_argmax(false), count(0)
+{
+}
+
+void ResponseBlender::Reset(cv::Size size, bool _track_mean, bool _track_argmax)
+{
+	track_mean = _track_mean;
+	track_argmax = _track_argmax;
+	count = 0;
+	max.create(size, CV_32F);
+	max.setTo(cv::Scalar(-std::numeric_limits<float>::max()));
+	if(track_mean)
+	{
+		sum.create(size, CV_32F);
+		sum.setTo(cv::Scalar(0));
+	}
+	if(track_argmax)
+	{
+		arg.create(size, CV_32F);
+		arg.setTo(cv::Scalar(0));
+	}
+}
+
+void ResponseBlender::Accumulate(const cv::Mat & response, int index)
+{
+	if(response.type() != CV_32FC1)
+		throw aia::error("in ResponseBlender::Accumulate(): only 32-bit float single channel responses are supported");
+	if(response.size() != max.size())
+		throw aia::error("in ResponseBlender::Accumulate(): response size differs from the blend size");
+
+	const float i = float(index < 0 ? count : index);
+	for(int y = 0; y < response.rows; y++)
+		AccumulateRow(response.ptr<float>(y), max.ptr<float>(y), track_mean ? sum.ptr<float>(y) : 0, track_argmax ? arg.ptr<float>(y) : 0, i, response.cols);
+	count++;
+}
+
+void ResponseBlender::Mean(cv::Mat & out) const
+{
+	if(!track_mean)
+		throw aia::error("in ResponseBlender::Mean(): mean not tracked");
+	sum.convertTo(out, CV_32F, count ? 1.0/count : 0.0);
+}
+
+void ResponseBlender::Argmax(cv::Mat & out) const
+{
+	if(!track_argmax)
+		throw aia::error("in ResponseBlender::Argmax(): argmax not tracked");
+	arg.convertTo(out, CV_8U);
+}
@@ -0,0 +1,38 @@
+#ifndef _Response_Blender_h
+#define _Response_Blender_h
+
+#include "aia/aiaConfig.h"
+#include "ucas/ucasConfig.h"
+
+using namespace std;
+
+// Streaming max / mean / argmax reduction of filter responses. Responses are
+// folded in as soon as they are computed, so blending N responses keeps the
+// running maximum (plus the running sum and argmax, if requested) instead of
+// N full frames.
+class ResponseBlender
+{
+public:
+	ResponseBlender();
+
+	// start a new blend of responses of the given size (buffers are reused when the size does not change)
+	void Reset(cv::Size size, bool track_mean = true, bool track_argmax = true);
+
+	// fold one CV_32F response in, 'index' (default: number of responses so far) is what Argmax() reports for it
+	void Accumulate(const cv::Mat & response, int index = -1);
+
+	int Count() const { return count; }
+	const cv::Mat & Max() const { return max; }
+	void Mean(cv::Mat & out) const;
+	void Argmax(cv::Mat & out) const;		// CV_8U
+
+	// row kernels: fold 'r' into the running max, and into the running sum and argmax unless null
+	static void AccumulateRow(const float * r, float * mx, float * sum, float * arg, float index, int n);
+
+private:
+	bool track_mean, track_argmax;
+	int count;
+	cv::Mat max, sum, arg;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "segmentation.h"
+#include "image_management.h"
+
+using namespace std;
+
+namespace
+{
+	// bank parameters on a level downsampled 'levels' times: lengths are halved at each level,
+	// kernels stay odd and at least 3x3, and the wavelength is kept above the Nyquist limit
+	GaborParams ScaleParams(const GaborParams & p, int levels)
+	{
+		const double f = 1.0 / (1 << levels);
+		GaborParams q = p;
+		q.ksize = cv::Size(std::max(3, int(p.ksize.width*f) | 1), std::max(3, int(p.ksize.height*f) | 1));
+		q.sigma = p.sigma*f;
+		q.lambda = std::max(2.0, p.lambda*f);
+		return q;
+	}
+
+	// 'p' if valid: checked before the coarse bank is scaled by 2^-levels
+	const PyramidParams & CheckPyramid(const PyramidParams & p)
+	{
+		if(p.levels < 0 || p.levels > 8)
+			throw aia::error(aia::strprintf("in VesselSegmenter(): invalid number of pyramid levels %d", p.levels));
+		if(p.tile_size < 1)
+			throw aia::error(aia::strprintf("in VesselSegmenter(): invalid tile size %d", p.tile_size));
+		return p;
+	}
+}
+
+VesselSegmenter::VesselSegmenter(const GaborParams & gabor_params, const PyramidParams & _pyramid)
+	: gabor(gabor_params), pyramid(CheckPyramid(_pyramid)), coarse_gabor(ScaleParams(gabor_params, pyramid.levels))
+{
+	halo = 0;
+	for(auto & k : gabor.Kernels())
+		halo = std::max(halo, std::max(k.rows, k.cols)/2);
+}
+
+const cv::Mat & VesselSegmenter::Apply(const cv::Mat & image, const cv::Mat & mask, int * threshold)
+{
+	const cv::Mat & gray = preprocessor.Apply(image, mask);
+
+	// in pyramid mode only the tiles holding coarse vessel candidates are filtered
+	const bool coarse_to_fine = pyramid.levels > 0 && gray.cols >= pyramid.min_cols;
+	vector<cv::Rect> tiles;
+	if(coarse_to_fine)
+	{
+		SelectCoarse(gray, mask, tiles);
+		ApplyTiles(gray, tiles);
+	}
+	else
+		gabor.Apply(gray, response);
+
+	// stretch the response to the 8-bit range the threshold selection works on
+	double min, max;
+	cv::minMaxIdx(response, &min, &max);
+	cv::convertScaleAbs(response, response8u, max > 0 ? 255 / max : 1.0);
+
+	// the threshold is selected on the full-frame statistics of the same stretched response it is applied to, in both modes:
+	// the coarse response comes from a different bank and is stretched by its own maximum, so its scale is not comparable,
+	// and the zero pairs of the skipped tiles are part of the statistics, as the zero background is at full resolution
+	selector.Compute(response8u);
+	const int t = selector.Select();
+	cv::threshold(response8u, vessels, t, 255, CV_THRESH_BINARY);
+	if(mask.data)
+		ImageManagement::ApplyMask(vessels, mask);
+
+	if(threshold)
+		*threshold = t;
+	return vessels;
+}
+
+void VesselSegmenter::SelectCoarse(const cv::Mat & gray, const cv::Mat & mask, vector<cv::Rect> & tiles)
+{
+	cv::pyrDown(gray, coarse);
+	for(int i = 1; i < pyramid.levels; i++)
+		cv::pyrDown(coarse, coarse);
+
+	// threshold of the coarse response within the FOV, stretched like the full-resolution one, only used to find candidates
+	if(mask.data)
+		cv::resize(mask, coarse_mask, coarse.size(), 0, 0, cv::INTER_NEAREST);
+	coarse_gabor.Apply(coarse, coarse_response);
+	double min, max;
+	cv::minMaxIdx(coarse_response, &min, &max);
+	cv::convertScaleAbs(coarse_response, candidates, max > 0 ? 255 / max : 1.0);
+	selector.Compute(candidates, mask.data ? coarse_mask : cv::Mat());
+	const int t = selector.Select();
+
+	// vessel candidates within the FOV, grown by one coarse pixel to cover their full-resolution extent
+	cv::threshold(candidates, candidates, pyramid.candidate_fraction * t, 255, CV_THRESH_BINARY);
+	if(mask.data)
+		ImageManagement::ApplyMask(candidates, coarse_mask);
+	cv::dilate(candidates, candidates, cv::Mat());
+
+	// full-resolution tiles overlapping at least one candidate
+	const double fx = double(coarse.cols) / gray.cols, fy = double(coarse.rows) / gray.rows;
+	const cv::Rect coarse_frame(0, 0, coarse.cols, coarse.rows);
+	tiles.clear();
+	for(int ty = 0; ty < gray.rows; ty += pyramid.tile_size)
+		for(int tx = 0; tx < gray.cols; tx += pyramid.tile_size)
+		{
+			cv::Rect core(tx, ty, std::min(pyramid.tile_size, gray.cols - tx), std::min(pyramid.tile_size, gray.rows - ty));
+			const int x0 = int(core.x * fx), y0 = int(core.y * fy);
+			const int x1 = int(std::ceil(core.br().x * fx)), y1 = int(std::ceil(core.br().y * fy));
+			const cv::Rect area = cv::Rect(x0, y0, std::max(x1 - x0, 1), std::max(y1 - y0, 1)) & coarse_frame;
+			if(area.area() && cv::countNonZero(candidates(area)))
+				tiles.push_back(core);
+		}
+}
+
+void VesselSegmenter::ApplyTiles(const cv::Mat & gray, const vector<cv::Rect> & tiles)
+{
+	// a tile padded with the kernel halo has the same response as the full frame: the bank reflects
+	// the borders only where the halo is clipped by the frame, i.e. where the full frame is reflected too
+	const cv::Rect frame(0, 0, gray.cols, gray.rows);
+	response.create(gray.size(), CV_32F);
+	response.setTo(cv::Scalar(0));
+	for(auto & core : tiles)
+	{
+		const cv::Rect outer = cv::Rect(core.x - halo, core.y - halo, core.width + 2*halo, core.height + 2*halo) & frame;
+		gabor.Apply(gray(outer), tile_response);
+		cv::Mat dst = response(core);
+		tile_response(cv::Rect(core.x - outer.x, core.y - outer.y, core.width, core.height)).copyTo(dst);
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef _Segmentation_h
+#define _Segmentation_h
+
+#include "aia/aiaConfig.h"
+#include "ucas/ucasConfig.h"
+#include "preprocessing.h"
+#include "gabor_bank.h"
+#include "threshold_selection.h"
+
+using namespace std;
+
+// coarse-to-fine mode of the segmenter for high-resolution inputs
+struct PyramidParams
+{
+	int levels;							// pyrDown steps to the coarse level (0 = full resolution only)
+	int min_cols;						// narrower images are always processed at full resolution
+	int tile_size;						// side of the full-resolution tiles the Gabor response is refined on
+	double candidate_fraction;			// coarse response > fraction * coarse threshold marks vessel candidates
+
+	PyramidParams(int _levels = 0, int _min_cols = 1600, int _tile_size = 128, double _candidate_fraction = 0.5)
+		: levels(_levels), min_cols(_min_cols), tile_size(_tile_size), candidate_fraction(_candidate_fraction){}
+};
+
+// The whole vessel segmentation chain of one image: preprocessing, Gabor
+// filtering, GLCM-entropy threshold selection and binarization within the
+// FOV. Every stage keeps its buffers, so a segmenter should be reused for
+// all the images a thread processes (and never shared between threads).
+// In pyramid mode vessel candidates are found on a downsampled level filtered
+// with a proportionally scaled bank and the full-resolution Gabor response is
+// computed only on the tiles holding candidates (zero elsewhere). The
+// threshold is selected on the full frame of that response, so the mask is
+// the full-resolution one whenever the skipped tiles have no response, like
+// the black background outside the FOV.
+class VesselSegmenter
+{
+public:
+	VesselSegmenter(const GaborParams & gabor_params = GaborParams(), const PyramidParams & pyramid = PyramidParams());
+
+	// 8-bit vessel mask (0/255) of 'image' within the optional FOV 'mask'
+	// the returned mask is owned by the segmenter and overwritten by the next call
+	const cv::Mat & Apply(const cv::Mat & image, const cv::Mat & mask, int * threshold = 0);
+
+private:
+	// tiles of 'gray' holding vessel candidates, found on the coarse level with its own threshold
+	void SelectCoarse(const cv::Mat & gray, const cv::Mat & mask, vector<cv::Rect> & tiles);
+
+	// 'gray' filtered on the given tiles only (zero elsewhere), into 'response'
+	void ApplyTiles(const cv::Mat & gray, const vector<cv::Rect> & tiles);
+
+	Preprocessor preprocessor;
+	GaborBank gabor;
+	ThresholdSelector selector;
+
+	PyramidParams pyramid;
+	GaborBank coarse_gabor;				// bank scaled to the coarse level
+	int halo;							// border needed by the full-resolution kernels
+	cv::Mat coarse, coarse_mask;		// coarse level of the preprocessed image and of the FOV mask
+	cv::Mat coarse_response, candidates;
+	cv::Mat tile_response;
+
+	cv::Mat response;					// maximum Gabor response
+	cv::Mat response8u;					// the same, stretched to 8 bits
+	cv::Mat vessels;					// binarized output
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "threshold_selection.h"
+#include <cmath>
+
+using namespace std;
+
+namespace
+{
+	inline double plogp(double p)
+	{
+		return p > 0 ? p*log(p) : 0.0;
+	}
+}
+
+vector<cv::Point> ThresholdSelector::DefaultOffsets()
+{
+	vector<cv::Point> offsets;
+	offsets.push_back(cv::Point(1, 0));
+	offsets.push_back(cv::Point(0, -1));
+	return offsets;
+}
+
+ThresholdSelector::ThresholdSelector(const vector<cv::Point> & _offsets) : offsets(_offsets), entropy(256, 0.0)
+{
+	if(offsets.empty())
+		throw aia::error("in ThresholdSelector(): no offsets given");
+}
+
+void ThresholdSelector::Compute(const cv::Mat & image, const cv::Mat & mask)
+{
+	if(image.type() != CV_8UC1)
+		throw aia::error("in ThresholdSelector::Compute(): only 8-bit single channel images are supported");
+	if(mask.data && (mask.type() != CV_8UC1 || mask.size() != image.size()))
+		throw aia::error("in ThresholdSelector::Compute(): mask must be 8-bit single channel and of the image size");
+
+	std::fill(entropy.begin(), entropy.end(), 0.0);
+	vector<int> hist_min(256), hist_a(256), hist_b(256);
+	for(size_t k = 0; k < offsets.size(); k++)
+	{
+		const int dx = offsets[k].x, dy = offsets[k].y;
+		std::fill(hist_min.begin(), hist_min.end(), 0);
+		std::fill(hist_a.begin(), hist_a.end(), 0);
+		std::fill(hist_b.begin(), hist_b.end(), 0);
+
+		// pairs (p, p+d) with both pixels inside the image
+		const int y0 = std::max(0, -dy), y1 = std::min(image.rows, image.rows - dy);
+		const int x0 = std::max(0, -dx), x1 = std::min(image.cols, image.cols - dx);
+		for(int y = y0; y < y1; y++)
+		{
+			const uchar * a = image.ptr<uchar>(y);
+			const uchar * b = image.ptr<uchar>(y + dy) + dx;
+			const uchar * ma = mask.data ? mask.ptr<uchar>(y) : 0;
+			const uchar * mb = mask.data ? mask.ptr<uchar>(y + dy) + dx : 0;
+			for(int x = x0; x < x1; x++)
+			{
+				if(ma && (!ma[x] || !mb[x]))
+					continue;
+				hist_a[a[x]]++;
+				hist_b[b[x]]++;
+				hist_min[std::min(a[x], b[x])]++;
+			}
+		}
+
+		// sweep the threshold downwards: n_a, n_b, n_ab = pairs with the first, the second, both pixels above t
+		double n_a = 0, n_b = 0, n_ab = 0;
+		for(int v = 0; v < 256; v++)
+			n_a += hist_a[v];
+		const double pairs = n_a;
+		if(!pairs)
+			continue;
+		n_a = 0;
+		for(int t = 255; t >= 0; t--)
+		{
+			// symmetric GLCM of (image > t) normalized by its 2*pairs entries
+			const double n_mixed = (n_a - n_ab) + (n_b - n_ab);
+			const double n_none = pairs - n_ab - n_mixed;
+			entropy[t] -= plogp(n_ab/pairs) + plogp(n_none/pairs) + 2*plogp(n_mixed/(2*pairs));
+
+			n_a += hist_a[t];
+			n_b += hist_b[t];
+			n_ab += hist_min[t];
+		}
+	}
+	for(int t = 0; t < 256; t++)
+		entropy[t] /= offsets.size();
+}
+
+int ThresholdSelector::Select(int first, int last, int step, double * max_entropy) const
+{
+	if(step < 1)
+		throw aia::error(aia::strprintf("in ThresholdSelector::Select(): invalid step %d", step));
+
+	int best = first;
+	double best_entropy = 0;
+	for(int t = first; t < last; t += step)
+		if(Entropy(t) > best_entropy)
+		{
+			best_entropy = Entropy(t);
+			best = t;
+		}
+	if(max_entropy)
+		*max_entropy = best_entropy;
+	return best;
+}
@@ -0,0 +1,38 @@
+#ifndef _Threshold_Selection_h
+#define _Threshold_Selection_h
+
+#include "aia/aiaConfig.h"
+#include "ucas/ucasConfig.h"
+
+using namespace std;
+
+// Selects the binarization threshold of an 8-bit response that maximizes the
+// entropy of the GLCM of the binarized image, averaged over a set of pixel
+// offsets. For a binary image the (symmetric) GLCM of offset d only depends
+// on how many pixel pairs (p, p+d) have both, one or none of the two values
+// above the threshold, i.e. on the histograms of min(I(p), I(p+d)) and of the
+// two marginals. These are gathered in one pass over the image, after which
+// the entropy of every threshold costs O(1).
+class ThresholdSelector
+{
+public:
+	// offsets are (dx, dy); the default matches the { 0,1, -1,0 } (dy, dx) step directions of the legacy GLCM
+	ThresholdSelector(const vector<cv::Point> & offsets = DefaultOffsets());
+
+	// gather the co-occurrence statistics of 'image' (8-bit, single channel), optionally within 'mask'
+	void Compute(const cv::Mat & image, const cv::Mat & mask = cv::Mat());
+
+	// mean GLCM entropy over the offsets of (image > t)
+	double Entropy(int t) const { return entropy[std::min(std::max(t, 0), 255)]; }
+
+	// threshold in {first, first+step, ...} below 'last' with maximum entropy (the first one on ties)
+	int Select(int first = 0, int last = 255, int step = 5, double * max_entropy = 0) const;
+
+	static vector<cv::Point> DefaultOffsets();
+
+private:
+	vector<cv::Point> offsets;
+	vector<double> entropy;				// mean entropy for each of the 256 thresholds
+};
+
+#endif
@@ -0,0 +1,123 @@
+// include aia and ucas utility functions
+#include "aia/aiaConfig.h"
+#include "ucas/ucasConfig.h"
+#include "dataset_index.h"
+#include "segmentation.h"
+#include <iostream>
+#include <atomic>
+#include <memory>
+
+using namespace std;
+
+// Headless vessel segmentation of a whole dataset. Images are independent
+// tasks of the global ucas::ThreadPool: idle threads steal the next image as
+// soon as they are done with the previous one, so slow images do not hold up
+// the others, and stages that are parallel themselves share the same cores.
+// A thread waiting inside a parallel stage only waits for the chunks of that
+// stage (it never starts another image meanwhile), so the time of an image
+// is the time of its own chain.
+int main(int argc, char** argv)
+{
+	try
+	{
+		if(argc < 4)
+		{
+			printf("usage: %s <images folder> <masks folder> <output folder> [image ext = .tif] [mask ext] [mask suffix = _mask] [pyramid levels = 0] [manifest]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		const string out_folder = argv[3];
+		const string ext = argc > 4 ? argv[4] : ".tif";
+		const string mask_ext = argc > 5 ? argv[5] : "";
+		const string mask_suffix = argc > 6 ? argv[6] : "_mask";
+		const int pyramid_levels = argc > 7 ? atoi(argv[7]) : 0;
+		const string manifest = argc > 8 ? argv[8] : "";
+
+		// an existing manifest is reused as is, skipping the indexing pass over every file; otherwise it is written for the next run
+		const bool reuse = !manifest.empty() && ucas::isFile(manifest);
+		const DatasetIndex dataset = reuse ? DatasetIndex::Open(manifest) : DatasetIndex(argv[1], argv[2], ext, mask_ext, mask_suffix);
+		if(!manifest.empty() && !reuse)
+			dataset.Save(manifest);
+		if(!dataset.Size())
+			throw aia::error(aia::strprintf("no images found in \"%s\"", argv[1]));
+		if(!ucas::check_and_make_dir(out_folder))
+			throw aia::error(aia::strprintf("cannot create output folder \"%s\"", out_folder.c_str()));
+
+		const size_t n = dataset.Size();
+		ucas::ThreadPool & pool = ucas::ThreadPool::global();
+		printf("Segmenting %d images on %d threads\n", int(n), pool.size() + 1);
+
+		std::atomic<int> failures(0);
+		std::mutex lock;
+		ucas::Timer wall;
+
+		// segmenters keep their buffers from one image to the next; they are checked out per image,
+		// so that no more of them are built than images run at the same time
+		vector< std::unique_ptr<VesselSegmenter> > segmenters;
+
+		pool.parallel_for(ucas::interval<int>(int(n)), [&](ucas::interval<int> r)
+		{
+			for(int i = r.start; i < r.end; i++)
+			{
+				std::unique_ptr<VesselSegmenter> segmenter;
+				{
+					std::unique_lock<std::mutex> lk(lock);
+					if(!segmenters.empty())
+					{
+						segmenter = std::move(segmenters.back());
+						segmenters.pop_back();
+					}
+				}
+				if(!segmenter)
+					segmenter.reset(new VesselSegmenter(GaborParams(), PyramidParams(pyramid_levels)));
+
+				const DatasetItem & item = dataset.Item(i);
+				ucas::Timer timer;
+				string error;
+				int threshold = 0;
+				try
+				{
+					cv::Mat image, mask;
+					dataset.Load(i, image, mask);
+					const cv::Mat & vessels = segmenter->Apply(image, mask, &threshold);
+					const string path = out_folder + "/" + item.stem + ".png";
+					if(!cv::imwrite(path, vessels))
+						throw aia::error(aia::strprintf("cannot write \"%s\"", path.c_str()));
+				}
+				catch(aia::error & ex)		{ error = ex.what(); }
+				catch(ucas::Error & ex)		{ error = ex.what(); }
+				catch(std::exception & ex)	{ error = ex.what(); }
+				const double seconds = timer.elapsed<double>();
+
+				std::unique_lock<std::mutex> lk(lock);
+				segmenters.push_back(std::move(segmenter));
+				if(error.empty())
+					printf("%s: threshold = %d, %.3f s\n", item.stem.c_str(), threshold, seconds);
+				else
+				{
+					failures++;
+					printf("%s: FAILED (%s)\n", item.stem.c_str(), error.c_str());
+				}
+			}
+		}, 1);
+
+		// per-image latencies overlap, so the throughput is measured on the wall clock
+		const double elapsed = wall.elapsed<double>();
+		printf("\n%d images (%d failed) in %.2f s: %.3f s/image, %.2f images/s\n",
+			int(n), int(failures), elapsed, elapsed / n, elapsed > 0 ? n / elapsed : 0.0);
+
+		return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	catch (aia::error &ex)
+	{
+		std::cout << "ERROR: " << ex.what() << std::endl;
+	}
+	catch (ucas::Error &ex)
+	{
+		std::cout << "ERROR: " << ex.what() << std::endl;
+	}
+	catch (std::exception &ex)
+	{
+		std::cout << "ERROR: " << ex.what() << std::endl;
+	}
+	return EXIT_FAILURE;
+}
@@ -1,5 +1,167 @@
 #include "ucasBreastUtils.h"
 #include "ucasTypes.h"
+#include <cfloat>
+
+namespace
+{
+	// number of pixels > 'threshold' from the cumulative histogram (cumulative[i] = # pixels <= i)
+	size_t countAbove(const std::vector<size_t> & cumulative, int threshold)
+	{
+		if(threshold < 0)
+			return cumulative.back();
+		if(threshold >= int(cumulative.size()))
+			return 0;
+		return cumulative.back() - cumulative[threshold];
+	}
+
+	// 256-bin histogram of the image after convertTo(CV_8U, 255.0/65535.0) if 16-bit, from its cumulative
+	// histogram: 16-bit levels are rounded to v/257, so 8-bit level k holds 16-bit levels [257k-128, 257k+128]
+	std::vector<int> histo8bit(const std::vector<size_t> & cumulative)
+	{
+		const int step = cumulative.size() == 256 ? 1 : 257;
+		const int half = step / 2;
+		std::vector<int> histo(256);
+		for(int k=0; k<256; k++)
+		{
+			const int lo = k*step - half, hi = std::min(k*step + half, int(cumulative.size())-1);
+			histo[k] = int(cumulative[hi] - (lo > 0 ? cumulative[lo-1] : 0));
+		}
+		return histo;
+	}
+
+	// threshold selected by cv::threshold(CV_THRESH_OTSU) on the 8-bit image with histogram 'histo',
+	// mapped back to the levels of the original image (pixel > t on the 8-bit image <=> pixel > 257t+128)
+	int otsuOpenCVThreshold(const std::vector<int> & histo, int depth)
+	{
+		// same between-class variance sweep as OpenCV's getThreshVal_Otsu_8u
+		double total = 0, mu = 0;
+		for(int i=0; i<256; i++)
+		{
+			total += histo[i];
+			mu += i*double(histo[i]);
+		}
+		const double scale = 1.0/total;
+		mu *= scale;
+		double mu1 = 0, q1 = 0, max_sigma = 0;
+		int max_val = 0;
+		for(int i=0; i<256; i++)
+		{
+			const double p_i = histo[i]*scale;
+			mu1 *= q1;
+			q1 += p_i;
+			const double q2 = 1.0 - q1;
+			if(std::min(q1,q2) < FLT_EPSILON || std::max(q1,q2) > 1.0 - FLT_EPSILON)
+				continue;
+			mu1 = (mu1 + i*p_i)/q1;
+			const double mu2 = (mu - q1*mu1)/q2;
+			const double sigma = q1*q2*(mu1 - mu2)*(mu1 - mu2);
+			if(sigma > max_sigma)
+			{
+				max_sigma = sigma;
+				max_val = i;
+			}
+		}
+		return depth == CV_16U ? 257*max_val + 128 : max_val;
+	}
+
+	// threshold of 'method' on the (manipulated) histogram 'histo' of an image of the given depth;
+	// with method == all, the fallback chain is tried in order and each candidate threshold is
+	// validated from the cumulative counts of the unmodified histogram
+	int breastThreshold(const std::vector<int> & histo, const std::vector<size_t> & cumulative, int threshold_shift,
+		ucas::binarizationMethod method, int depth, ucas::StackPrinter *printer) throw (ucas::Error)
+	{
+		if(method == ucas::otsuopencv)
+			return otsuOpenCVThreshold(histo8bit(cumulative), depth);
+		else if(method == ucas::otsu)
+			return ucas::getOtsuAutoThreshold(histo)+threshold_shift;
+		else if(method == ucas::isodata)
+			return ucas::getIsoDataAutoThreshold(histo)+threshold_shift;
+		else if(method == ucas::mean)
+			return ucas::getMeanThreshold(histo)+threshold_shift;
+		else if(method == ucas::minerror)
+			return ucas::getMinErrorIThreshold(histo)+threshold_shift;
+		else if(method == ucas::maxentropy)
+			return ucas::getMaxEntropyAutoThreshold(histo)+threshold_shift;
+		else if(method == ucas::renyientropy)
+			return ucas::getRenyiEntropyAutoThreshold(histo)+threshold_shift;
+		else if(method == ucas::yen)
+			return ucas::getYenyAutoThreshold(histo)+threshold_shift;
+		else if(method == ucas::triangle)
+			return ucas::getTriangleAutoThreshold(histo)+threshold_shift;
+		else if(method != ucas::all)
+			throw ucas::Error("in breastSegment(): unsupported binarization method");
+
+		// fallback chain: each method is tried only if the previous ones failed
+		static const ucas::binarizationMethod chain[] = {ucas::otsuopencv, ucas::yen, ucas::renyientropy, ucas::maxentropy, ucas::minerror};
+		static const char* failures[] = {"Otsu failed, try Yeni\n", "Yeni failed, try Renyi\n", "Renyi failed, try MaxEntropy\n", "MaxEntropy failed, try MinError\n"};
+		const int n_methods = sizeof(chain)/sizeof(chain[0]);
+		for(int k = 0; k < n_methods; k++)
+		{
+			const int threshold = breastThreshold(histo, cumulative, threshold_shift, chain[k], depth, printer);
+			if(ucas::checkBreastMask(countAbove(cumulative, threshold), cumulative.back()))
+				return threshold;
+			if(printer && k < n_methods-1)
+				printer->printf(failures[k]);
+		}
+		throw ucas::Error("cannot segment breast: all binarization methods failed");
+	}
+
+	// keep only the greatest connected component of the binary 'mask', filled
+	void largestComponent(cv::Mat & mask)
+	{
+		std::vector< std::vector<cv::Point> > ccs;
+		cv::findContours(mask, ccs, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+		double areaMax = -1;
+		int ccsIdxAreaMax = -1;
+		for(int i=0; i<ccs.size(); i++)
+		{
+			if(cv::contourArea(ccs[i]) > areaMax)
+			{
+				areaMax = cv::contourArea(ccs[i]);
+				ccsIdxAreaMax = i;
+			}
+		}
+		if(ccsIdxAreaMax != -1)
+		{
+			std::vector< std::vector<cv::Point> > ccsAreaMax;
+			ccsAreaMax.push_back(ccs[ccsIdxAreaMax]);
+			mask.setTo(cv::Scalar(0));
+			cv::drawContours(mask, ccsAreaMax, -1, cv::Scalar(255), CV_FILLED);
+		}
+	}
+
+	// pixels of the band set to image > threshold, the others left as they are
+	template <typename T>
+	void refineBand(const cv::Mat & image, const cv::Mat & band, int threshold, cv::Mat & mask)
+	{
+		for(int y=0; y<image.rows; y++)
+		{
+			const T* image_row = image.ptr<T>(y);
+			const ucas::uint8* band_row = band.ptr<ucas::uint8>(y);
+			ucas::uint8* mask_row = mask.ptr<ucas::uint8>(y);
+			for(int x=0; x<image.cols; x++)
+				if(band_row[x])
+					mask_row[x] = image_row[x] > threshold ? 255 : 0;
+		}
+	}
+
+	// full-resolution breast mask from the mask 'coarse' of the subsampled image: the upsampled mask is kept
+	// as it is except on a band of one coarse pixel around its boundary, which is binarized again at full resolution
+	cv::Mat refineMask(const cv::Mat & image, const cv::Mat & coarse, int threshold)
+	{
+		cv::Mat inner, band, mask;
+		cv::erode(coarse, inner, cv::Mat());
+		cv::dilate(coarse, band, cv::Mat());
+		band -= inner;
+		cv::resize(coarse, mask, image.size(), 0, 0, cv::INTER_NEAREST);
+		cv::resize(band, band, image.size(), 0, 0, cv::INTER_NEAREST);
+		if(image.depth() == CV_8U)
+			refineBand<ucas::uint8>(image, band, threshold, mask);
+		else
+			refineBand<ucas::uint16>(image, band, threshold, mask);
+		return mask;
+	}
+}
 
 // returns the binary image consisting of the segmented breast
 cv::Mat ucas::breastSegment(
@@ -8,7 +170,8 @@ cv::Mat ucas::breastSegment(
 	bool noBlack /*= false*/,		// exclude black (=0) pixels from computation of global threshold
 	bool noWhite /*= false*/,		// exclude white (=2^depth-1) pixels from computation of global threshold
 	bool bracket_histo /*= false*/,	// bracket the histogram to the range that holds data to make it quicker
-	ucas::StackPrinter *printer)
+	ucas::StackPrinter *printer,
+	int pyramid_levels /*= 0*/)		// coarse level the threshold and the mask are computed on
 	throw ( ucas::Error )
 {
 	// checks
@@ -19,11 +182,25 @@ cv::Mat ucas::breastSegment(
 	if(image.depth() != CV_8U && image.depth() != CV_16U)
 		throw ucas::Error("in breastSegment(): unsupported bitdepth: only 8- and 16-bit grayscale image are supported");
 
-	// create a clone of the given image
-	cv::Mat res = image.clone();
+	// in pyramid mode the threshold and the mask are computed on a subsampled image: nearest-neighbour
+	// subsampling keeps its histogram an unbiased sample of the gray levels of the full image
+	const bool coarse = pyramid_levels > 0 && (image.rows >> pyramid_levels) >= 16 && (image.cols >> pyramid_levels) >= 16;
+	cv::Mat level = image;
+	if(coarse)
+		cv::resize(image, level, cv::Size(image.cols >> pyramid_levels, image.rows >> pyramid_levels), 0, 0, cv::INTER_NEAREST);
+
+	// binary mask
+	cv::Mat res;
 
 	// calculate histogram
-	std::vector<int> histo = histogram(image);
+	std::vector<int> histo = histogram(level);
+
+	// cumulative counts of the unmodified histogram: the number of white pixels of any candidate threshold,
+	// and hence its validity as a breast mask, is known without binarizing the image
+	std::vector<size_t> cumulative(histo.size());
+	size_t count = 0;
+	for(size_t i=0; i<histo.size(); i++)
+		cumulative[i] = count += histo[i];
 
 	// histogram manipulations prior to binarization
 	int threshold_shift=0;
@@ -35,93 +212,33 @@ cv::Mat ucas::breastSegment(
 		histo = compressHistogram(histo, threshold_shift);
 
 	// apply selected binarization method
-	if(method == ucas::otsuopencv)
+	int threshold = 0;
+	if(method == ucas::otsuopencv && !coarse)
 	{
 		// convert to 8 bit if image is 16 bit, since OpenCV thresholding functions can be applied to 8 bit images only
+		res = image.clone();
 		if(res.depth() == CV_16U)
 			res.convertTo(res, CV_8U, 255.0/65535.0);
 		cv::threshold(res, res, 0, 255, CV_THRESH_BINARY | CV_THRESH_OTSU);
 	}
-	else if(method == ucas::otsu)
-		ucas::binarize(res, getOtsuAutoThreshold(histo)+threshold_shift);
-	else if(method == ucas::isodata)
-		ucas::binarize(res, getIsoDataAutoThreshold(histo)+threshold_shift);
-	else if(method == ucas::mean)
-		ucas::binarize(res, getMeanThreshold(histo)+threshold_shift);
-	else if(method == ucas::minerror)
-		ucas::binarize(res, getMinErrorIThreshold(histo)+threshold_shift);
-	else if(method == ucas::maxentropy)
-		ucas::binarize(res, getMaxEntropyAutoThreshold(histo)+threshold_shift);
-	else if(method == ucas::renyientropy)
-		ucas::binarize(res, getRenyiEntropyAutoThreshold(histo)+threshold_shift);
-	else if(method == ucas::yen)
-		ucas::binarize(res, getYenyAutoThreshold(histo)+threshold_shift);
-	else if(method == ucas::triangle)
-		ucas::binarize(res, getTriangleAutoThreshold(histo)+threshold_shift);
-	else if(method == ucas::all)
+	else
 	{
-		// convert to 8 bit if image is 16 bit, since OpenCV thresholding functions can be applied to 8 bit images only
-		if(res.depth() == CV_16U)
-			res.convertTo(res, CV_8U, 255.0/65535.0);
-		cv::threshold(res, res, 0, 255, CV_THRESH_BINARY | CV_THRESH_OTSU);
-		if(!ucas::checkBreastMask(res))
-		{
-			if(printer)
-				printer->printf("Otsu failed, try Yeni\n");
-			res = image.clone();
-			ucas::binarize(res, getYenyAutoThreshold(histo)+threshold_shift);
-			if(!ucas::checkBreastMask(res))
-			{
-				if(printer)
-					printer->printf("Yeni failed, try Renyi\n");
-				res = image.clone();
-				ucas::binarize(res, getRenyiEntropyAutoThreshold(histo)+threshold_shift);
-				if(!ucas::checkBreastMask(res))
-				{
-					if(printer)
-						printer->printf("Renyi failed, try MaxEntropy\n");
-					res = image.clone();
-					ucas::binarize(res, getMaxEntropyAutoThreshold(histo)+threshold_shift);
-					if(!ucas::checkBreastMask(res))
-					{
-						if(printer)
-							printer->printf("MaxEntropy failed, try MinError\n");
-						res = image.clone();
-						ucas::binarize(res, getMinErrorIThreshold(histo)+threshold_shift);
-
-						if(!ucas::checkBreastMask(res))
-							throw ucas::Error("cannot segment breast: all binarization methods failed");
-					}
-				}
-			}
-		}
+		threshold = breastThreshold(histo, cumulative, threshold_shift, method, level.depth(), printer);
+		ucas::binarize(level, res, threshold);
 	}
-	else
-		throw ucas::Error("in breastSegment(): unsupported binarization method");
-
 
 	// closing
 	//cv::morphologyEx(res, res, CV_MOP_CLOSE, cv::getStructuringElement(CV_SHAPE_RECT, cv::Size(60,60)));
 
 	// select greatest connected component
-	std::vector< std::vector<cv::Point> > ccs;
-	cv::findContours(res, ccs, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
-	double areaMax = -1;
-	int ccsIdxAreaMax = -1;
-	for(int i=0; i<ccs.size(); i++)
-	{
-		if(cv::contourArea(ccs[i]) > areaMax)
-		{
-			areaMax = cv::contourArea(ccs[i]);
-			ccsIdxAreaMax = i;
-		}
-	}
-	if(ccsIdxAreaMax != -1)
+	largestComponent(res);
+
+	// the band binarized again at full resolution may open holes and leave specks along the contour,
+	// which the greatest connected component of the full-resolution path never has
+	if(coarse)
 	{
-		std::vector< std::vector<cv::Point> > ccsAreaMax;
-		ccsAreaMax.push_back(ccs[ccsIdxAreaMax]);
-		res.setTo(cv::Scalar(0));
-		cv::drawContours(res, ccsAreaMax, -1, cv::Scalar(255), CV_FILLED);
+		res = refineMask(image, res, threshold);
+		largestComponent(res);
 	}
 
 	return res;
@@ -153,12 +270,22 @@ bool ucas::checkBreastMask(
 				black_c++;
 	}
 
+	return checkBreastMask(white_c, size_t(white_c) + black_c, minF, maxF);
+}
+
+// returns true if a breast mask with 'white' foreground pixels out of 'total' satisfies the conditions above
+bool ucas::checkBreastMask(
+	size_t white,					// number of white pixels
+	size_t total,					// number of pixels
+	float minF,						// minimum fraction of white/total pixels
+	float maxF)						// maximum fraction of white/total pixels
+{
 	// can't be all black or all white
-	if(white_c == 0 || black_c == 0)
+	if(white == 0 || white == total)
 		return false;
 
 	// segmented area should be within a certain range of the total area of the image
-	if(float(white_c) < minF*mask.rows*mask.cols || float(white_c) > maxF*mask.rows*mask.cols)
+	if(float(white) < minF*total || float(white) > maxF*total)
 		return false;
 
 	return true;
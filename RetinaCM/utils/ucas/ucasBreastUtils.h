@@ -16,7 +16,9 @@ namespace ucas
 		bool noBlack = false,			// exclude black (=0) pixels from computation of global threshold
 		bool noWhite = false,			// exclude white (=2^depth-1) pixels from computation of global threshold
 		bool bracket_histo = true,		// bracket the histogram to the range that holds data to make it quicker
-		ucas::StackPrinter *printer = 0)
+		ucas::StackPrinter *printer = 0,
+		int pyramid_levels = 0)			// if > 0, threshold and segment a 2^-levels subsampled image and binarize
+										// only a band around the upsampled mask boundary at full resolution
 		throw ( ucas::Error );
 
 	// returns true if the given breast mask contains B white pixels, with minP*size(mask) <= B <= maxP*size(mask)
@@ -25,6 +27,14 @@ namespace ucas
 		float minF = 0.05,				// minimum fraction of white/total pixels
 		float maxF = 0.95				// maximum fraction of white/total pixels
 	) throw (Error);
+
+	// same as above from the number of white pixels, e.g. counted on the histogram before binarizing
+	bool checkBreastMask(
+		size_t white,					// number of white pixels
+		size_t total,					// number of pixels
+		float minF = 0.05,				// minimum fraction of white/total pixels
+		float maxF = 0.95				// maximum fraction of white/total pixels
+	);
 }
 
 #endif
\ No newline at end of file
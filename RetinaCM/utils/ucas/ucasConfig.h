@@ -16,6 +16,8 @@
 #include "ucasMathUtils.h"
 #include "ucasImageUtils.h"
 #include "ucasBreastUtils.h"
+#include "ucasDicomUtils.h"
+#include "ucasTextureUtils.h"
 #include "ucasExceptions.h"
 #include "ucasLog.h"
 #include "ucasStringUtils.h"
@@ -0,0 +1,376 @@
+#include "ucasDicomUtils.h"
+#include "ucasStringUtils.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	const char* EXPLICIT_VR_LITTLE_ENDIAN = "1.2.840.10008.1.2.1";
+	const char* IMPLICIT_VR_LITTLE_ENDIAN = "1.2.840.10008.1.2";
+	const unsigned int UNDEFINED_LENGTH = 0xFFFFFFFF;
+
+	inline unsigned int get16(const unsigned char* p)
+	{
+		return p[0] | (p[1] << 8);
+	}
+	inline unsigned int get32(const unsigned char* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24);
+	}
+
+	// VRs with a reserved 16-bit field followed by a 32-bit length in explicit VR transfer syntaxes
+	inline bool longVR(const unsigned char* vr)
+	{
+		static const char* vrs[] = {"OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV"};
+		for(int i=0; i<int(sizeof(vrs)/sizeof(vrs[0])); i++)
+			if(vr[0] == vrs[i][0] && vr[1] == vrs[i][1])
+				return true;
+		return false;
+	}
+
+	// header of a data element
+	struct dicomElement
+	{
+		unsigned int group, elem;
+		const unsigned char* vr;		// 0 for items, delimiters and implicit VR elements
+		unsigned int length;
+		size_t value;					// offset of the value
+	};
+
+	// sequential reader of the data elements of a little endian DICOM stream
+	class dicomReader
+	{
+		public:
+
+			dicomReader(const unsigned char* _data, size_t _size, size_t _pos) : data(_data), size(_size), pos(_pos), explicitVR(true){}
+
+			bool atEnd() const { return pos >= size; }
+			unsigned int peekGroup() const { return pos + 2 <= size ? get16(data + pos) : 0; }
+
+			// read the header of the next element, leaving the reader on its value
+			void next(dicomElement & e) throw (ucas::Error)
+			{
+				need(8);
+				e.group = get16(data + pos);
+				e.elem = get16(data + pos + 2);
+				e.vr = 0;
+
+				// items and delimiters have no VR in any transfer syntax
+				if(e.group == 0xFFFE || !explicitVR)
+				{
+					e.length = get32(data + pos + 4);
+					pos += 8;
+				}
+				else if(longVR(data + pos + 4))
+				{
+					need(12);
+					e.vr = data + pos + 4;
+					e.length = get32(data + pos + 8);
+					pos += 12;
+				}
+				else
+				{
+					e.vr = data + pos + 4;
+					e.length = get16(data + pos + 6);
+					pos += 8;
+				}
+				e.value = pos;
+			}
+
+			// skip the value of 'e', nested sequences and items of undefined length included
+			void skip(const dicomElement & e, int depth = 0) throw (ucas::Error)
+			{
+				if(e.length != UNDEFINED_LENGTH)
+				{
+					need(e.length);
+					pos += e.length;
+					return;
+				}
+				if(depth > 32)
+					throw ucas::Error("malformed DICOM file: too many nested sequences");
+
+				// sequences of undefined length end with a sequence delimiter, items with an item delimiter;
+				// UN values of undefined length are sequences encoded in implicit VR
+				const bool explicitVR_ = explicitVR;
+				if(e.vr && e.vr[0] == 'U' && e.vr[1] == 'N')
+					explicitVR = false;
+				dicomElement nested;
+				while(true)
+				{
+					next(nested);
+					if(nested.group == 0xFFFE && (nested.elem == 0xE0DD || nested.elem == 0xE00D))
+						break;
+					skip(nested, depth + 1);
+				}
+				explicitVR = explicitVR_;
+			}
+
+			const unsigned char* data;
+			size_t size;
+			size_t pos;
+			bool explicitVR;
+
+		private:
+
+			void need(size_t bytes) const throw (ucas::Error)
+			{
+				if(bytes > size - pos)
+					throw ucas::Error("malformed DICOM file: truncated data element");
+			}
+	};
+
+	// unsigned short value of 'e'
+	inline int valueUS(const dicomReader & r, const dicomElement & e) throw (ucas::Error)
+	{
+		if(e.length < 2 || e.value + 2 > r.size)
+			throw ucas::Error(ucas::strprintf("malformed DICOM file: invalid US value of (%04X,%04X)", e.group, e.elem));
+		return int(get16(r.data + e.value));
+	}
+
+	// string value of 'e' without its padding
+	inline std::string valueString(const dicomReader & r, const dicomElement & e)
+	{
+		size_t length = std::min(size_t(e.length), r.size - e.value);
+		while(length && (r.data[e.value + length - 1] == 0 || r.data[e.value + length - 1] == ' '))
+			length--;
+		return std::string(reinterpret_cast<const char*>(r.data + e.value), length);
+	}
+
+#if CV_MAJOR_VERSION < 3
+	// OpenCV 2.x: the reference counter of a mapped matrix is the first member of a block that also owns the
+	// mapping. Matrices later reallocated through the same allocator (e.g. by create()) get a heap block.
+	struct mappedBlock
+	{
+		int refcount;
+		ucas::MappedFile* file;
+	};
+
+	class MappedAllocator : public cv::MatAllocator
+	{
+		public:
+
+			void allocate(int dims, const int* sizes, int type, int*& refcount, uchar*& datastart, uchar*& data, size_t* step)
+			{
+				size_t total = CV_ELEM_SIZE(type);
+				for(int i = dims-1; i >= 0; i--)
+				{
+					if(step)
+						step[i] = total;
+					total *= sizes[i];
+				}
+				mappedBlock* block = new mappedBlock();
+				block->refcount = 1;
+				block->file = 0;
+				datastart = data = static_cast<uchar*>(cv::fastMalloc(total));
+				refcount = &block->refcount;
+			}
+
+			void deallocate(int* refcount, uchar* datastart, uchar*)
+			{
+				mappedBlock* block = reinterpret_cast<mappedBlock*>(refcount);
+				if(block->file)
+					delete block->file;
+				else
+					cv::fastFree(datastart);
+				delete block;
+			}
+	};
+#else
+	// OpenCV 3.x and later: the mapping is the user data of the UMatData of a mapped matrix, and is released
+	// with it. Matrices later reallocated through the same allocator get a standard buffer.
+#if CV_MAJOR_VERSION < 4
+	typedef int accessFlag;
+#else
+	typedef cv::AccessFlag accessFlag;
+#endif
+	class MappedAllocator : public cv::MatAllocator
+	{
+		public:
+
+			cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, accessFlag flags, cv::UMatUsageFlags usage) const
+			{
+				return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+			}
+
+			bool allocate(cv::UMatData* u, accessFlag flags, cv::UMatUsageFlags usage) const
+			{
+				return cv::Mat::getStdAllocator()->allocate(u, flags, usage);
+			}
+
+			void deallocate(cv::UMatData* u) const
+			{
+				delete static_cast<ucas::MappedFile*>(u->userdata);
+				delete u;
+			}
+	};
+#endif
+
+	MappedAllocator mappedAllocator;
+
+	// matrix header over 'data', owning 'file' (which must contain 'data')
+	cv::Mat wrapMapped(std::unique_ptr<ucas::MappedFile> & file, unsigned char* data, int rows, int cols, int type)
+	{
+		cv::Mat mat(rows, cols, type, data);
+#if CV_MAJOR_VERSION < 3
+		mappedBlock* block = new mappedBlock();
+		block->refcount = 1;
+		block->file = file.release();
+		mat.refcount = &block->refcount;
+#else
+		cv::UMatData* u = new cv::UMatData(&mappedAllocator);
+		u->data = u->origdata = data;
+		u->size = mat.step[0] * rows;
+		u->userdata = file.release();
+		u->refcount = 1;
+		mat.u = u;
+#endif
+		mat.allocator = &mappedAllocator;
+		return mat;
+	}
+}
+
+// map the whole file (copy-on-write)
+ucas::MappedFile::MappedFile(const std::string & path) throw (ucas::Error) : ptr(0), length(0)
+{
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if(file == INVALID_HANDLE_VALUE)
+		throw ucas::Error(ucas::strprintf("in MappedFile(): cannot open \"%s\"", path.c_str()));
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		throw ucas::Error(ucas::strprintf("in MappedFile(): cannot map empty file \"%s\"", path.c_str()));
+	}
+	length = size_t(file_size.QuadPart);
+	mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+	if(mapping)
+		ptr = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+	if(!ptr)
+	{
+		if(mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		throw ucas::Error(ucas::strprintf("in MappedFile(): cannot map \"%s\"", path.c_str()));
+	}
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw ucas::Error(ucas::strprintf("in MappedFile(): cannot open \"%s\"", path.c_str()));
+	struct stat s;
+	if(fstat(fd, &s) != 0 || s.st_size == 0)
+	{
+		::close(fd);
+		throw ucas::Error(ucas::strprintf("in MappedFile(): cannot map empty file \"%s\"", path.c_str()));
+	}
+	length = size_t(s.st_size);
+	void* p = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(p == MAP_FAILED)
+		throw ucas::Error(ucas::strprintf("in MappedFile(): cannot map \"%s\"", path.c_str()));
+	ptr = static_cast<unsigned char*>(p);
+#endif
+}
+
+ucas::MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	UnmapViewOfFile(ptr);
+	CloseHandle(mapping);
+	CloseHandle(file);
+#else
+	munmap(ptr, length);
+#endif
+}
+
+// parse preamble, file meta group and data set up to the pixel data
+bool ucas::parseDicomHeader(const unsigned char* data, size_t size, ucas::dicomHeader & header) throw (ucas::Error)
+{
+	header = dicomHeader();
+	if(size < 132 || std::memcmp(data + 128, "DICM", 4) != 0)
+		return false;
+
+	// file meta group: always explicit VR little endian
+	dicomReader r(data, size, 132);
+	dicomElement e;
+	while(!r.atEnd() && r.peekGroup() == 0x0002)
+	{
+		r.next(e);
+		if(e.elem == 0x0010)
+			header.transferSyntax = valueString(r, e);
+		r.skip(e);
+	}
+	if(header.transferSyntax == IMPLICIT_VR_LITTLE_ENDIAN)
+		r.explicitVR = false;
+	else if(header.transferSyntax != EXPLICIT_VR_LITTLE_ENDIAN)
+		return false;
+
+	// data set: only the image pixel module is read, everything else (nested sequences included) is skipped
+	while(!r.atEnd())
+	{
+		r.next(e);
+		if(e.group == 0x7FE0 && e.elem == 0x0010)
+		{
+			header.pixelOffset = e.value;
+			header.pixelLength = e.length == UNDEFINED_LENGTH ? 0 : e.length;
+			return true;
+		}
+		if(e.group == 0x0028 && e.length != UNDEFINED_LENGTH)
+		{
+			switch(e.elem)
+			{
+				case 0x0002: header.samplesPerPixel = valueUS(r, e); break;
+				case 0x0008: header.frames = std::atoi(valueString(r, e).c_str()); break;
+				case 0x0010: header.rows = valueUS(r, e); break;
+				case 0x0011: header.cols = valueUS(r, e); break;
+				case 0x0100: header.bitsAllocated = valueUS(r, e); break;
+				case 0x0101: header.bitsStored = valueUS(r, e); break;
+				case 0x0103: header.pixelRepresentation = valueUS(r, e); break;
+			}
+		}
+		r.skip(e);
+	}
+	throw ucas::Error("malformed DICOM file: no pixel data");
+}
+
+// uncompressed single-frame grayscale image as a view of the mapped file
+cv::Mat ucas::dicomMap(const std::string & path, int *bits_used) throw (ucas::Error)
+{
+	// pixel data are little endian
+	const unsigned short one = 1;
+	if(*reinterpret_cast<const unsigned char*>(&one) != 1)
+		return cv::Mat();
+
+	std::unique_ptr<MappedFile> file(new MappedFile(path));
+	dicomHeader header;
+	if(!parseDicomHeader(file->data(), file->size(), header))
+		return cv::Mat();
+
+	// 16-bit views need even offsets, which well-formed files always have (element values have even lengths)
+	const int bytes = header.bitsAllocated / 8;
+	if(header.rows <= 0 || header.cols <= 0 || header.samplesPerPixel != 1 || header.frames != 1 ||
+		(header.bitsAllocated != 8 && header.bitsAllocated != 16) || header.pixelRepresentation != 0 ||
+		header.pixelOffset % bytes != 0)
+		return cv::Mat();
+	const size_t frame = size_t(header.rows) * header.cols * bytes;
+	if(header.pixelLength < frame || frame > file->size() - header.pixelOffset)
+		return cv::Mat();
+
+	if(bits_used)
+		*bits_used = header.bitsStored;
+	return wrapMapped(file, file->data() + header.pixelOffset, header.rows, header.cols, bytes == 1 ? CV_8U : CV_16U);
+}
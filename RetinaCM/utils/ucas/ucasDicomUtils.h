@@ -0,0 +1,68 @@
+#ifndef _UCAS_DICOM_UTILS_H
+#define _UCAS_DICOM_UTILS_H
+
+#include <opencv2/core/core.hpp>
+#include "ucasExceptions.h"
+#include <string>
+
+/*****************************************************************
+*   Memory-mapped DICOM images                                   *
+******************************************************************/
+namespace ucas
+{
+	// read-only view of a whole file mapped in memory. The mapping is private
+	// (copy-on-write), so writing through it never modifies the file.
+	class MappedFile
+	{
+		public:
+
+			MappedFile(const std::string & path) throw (ucas::Error);
+			~MappedFile();
+
+			const unsigned char* data() const { return ptr; }
+			unsigned char* data() { return ptr; }
+			size_t size() const { return length; }
+
+		private:
+
+			// non copyable
+			MappedFile(const MappedFile &);
+			MappedFile & operator=(const MappedFile &);
+
+			unsigned char* ptr;
+			size_t length;
+#ifdef _WIN32
+			void* file;
+			void* mapping;
+#endif
+	};
+
+	// header fields of a single-frame DICOM image needed to locate and interpret its pixel data
+	struct dicomHeader
+	{
+		std::string transferSyntax;		// (0002,0010) transfer syntax UID
+		int rows, cols;					// (0028,0010) and (0028,0011)
+		int samplesPerPixel;			// (0028,0002)
+		int bitsAllocated, bitsStored;	// (0028,0100) and (0028,0101)
+		int pixelRepresentation;		// (0028,0103): 0 = unsigned, 1 = signed
+		int frames;						// (0028,0008)
+		size_t pixelOffset;				// byte offset of the pixel data value in the file
+		size_t pixelLength;				// byte length of the pixel data (0 if encapsulated)
+
+		dicomHeader() : rows(0), cols(0), samplesPerPixel(1), bitsAllocated(0), bitsStored(0), pixelRepresentation(0),
+			frames(1), pixelOffset(0), pixelLength(0){}
+	};
+
+	// parse the first 'size' bytes of a DICOM file (preamble, "DICM", file meta group and data set) up to the
+	// pixel data element, without copying any value but the transfer syntax. Returns false if the file is not a
+	// DICOM file in the explicit or implicit VR little endian transfer syntax, throws if it is malformed.
+	bool parseDicomHeader(const unsigned char* data, size_t size, dicomHeader & header) throw (ucas::Error);
+
+	// the image in the DICOM file 'path' as a cv::Mat view of its memory-mapped pixel data (8- or 16-bit unsigned,
+	// single sample, single frame, uncompressed), so that opening it costs the same whatever its size and pixel
+	// pages are read from disk only when touched. The mapping lives as long as the returned matrix or any of its
+	// copies. Returns an empty matrix if the image is not supported by this path (e.g. compressed).
+	cv::Mat dicomMap(const std::string & path, int *bits_used = 0) throw (ucas::Error);
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include "ucasEvaluationUtils.h"
+#include "ucasMultithreading.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UCAS_EVALUATION_SSE2
+#endif
+
+namespace
+{
+	inline unsigned int popcount16(unsigned int x)
+	{
+		x = x - ((x >> 1) & 0x5555);
+		x = (x & 0x3333) + ((x >> 2) & 0x3333);
+		x = (x + (x >> 4)) & 0x0F0F;
+		return (x + (x >> 8)) & 0x1F;
+	}
+
+	// count one row: 16 pixels at a time, as bitmasks of nonzero bytes
+	void countRow(const uchar * p, const uchar * t, const uchar * f, int n, ucas::classification_outcome & o)
+	{
+		unsigned long long TP = 0, FP = 0, FN = 0, in = 0;
+		int x = 0;
+#ifdef UCAS_EVALUATION_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for(; x <= n - 16; x += 16)
+		{
+			const unsigned int mp = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + x)), zero)) & 0xFFFF;
+			const unsigned int mt = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(t + x)), zero)) & 0xFFFF;
+			const unsigned int mf = f ? ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(f + x)), zero)) & 0xFFFF : 0xFFFF;
+			TP += popcount16(mp & mt & mf);
+			FP += popcount16(mp & ~mt & mf);
+			FN += popcount16(~mp & mt & mf);
+			in += popcount16(mf);
+		}
+#endif
+		for(; x < n; x++)
+			if(!f || f[x])
+			{
+				in++;
+				if(p[x])
+					(t[x] ? TP : FP)++;
+				else if(t[x])
+					FN++;
+			}
+		o.TP += TP;
+		o.FP += FP;
+		o.FN += FN;
+		o.TN += in - TP - FP - FN;
+	}
+
+	// bin the masked scores of each row straight into the histogram of their class
+	template <typename T>
+	void binRows(const cv::Mat & scores, const cv::Mat & truth, const cv::Mat & fov, ucas::interval<int> rows, ucas::ml::ROC_histogram & h)
+	{
+		for(int y = rows.start; y < rows.end; y++)
+			h.add(scores.ptr<T>(y), truth.ptr<uchar>(y), fov.data ? fov.ptr<uchar>(y) : 0, size_t(scores.cols));
+	}
+
+	void checkInputs(const char * func, const cv::Mat & image, const cv::Mat & truth, const cv::Mat & fov) throw (ucas::Error)
+	{
+		if(!image.data || image.channels() != 1)
+			throw ucas::Error(ucas::strprintf("in %s(): invalid image: a single channel image is required", func));
+		if(truth.type() != CV_8UC1 || truth.size() != image.size())
+			throw ucas::Error(ucas::strprintf("in %s(): ground truth must be an 8-bit single channel image of the same size", func));
+		if(fov.data && (fov.type() != CV_8UC1 || fov.size() != image.size()))
+			throw ucas::Error(ucas::strprintf("in %s(): FOV mask must be an 8-bit single channel image of the same size", func));
+	}
+}
+
+ucas::classification_outcome ucas::segmentationOutcome(const cv::Mat & prediction, const cv::Mat & truth, const cv::Mat & fov) throw (ucas::Error)
+{
+	checkInputs("segmentationOutcome", prediction, truth, fov);
+	if(prediction.depth() != CV_8U)
+		throw ucas::Error("in segmentationOutcome(): unsupported bitdepth: prediction must be an 8-bit image");
+
+	classification_outcome out;
+	std::mutex lock;
+	ucas::ThreadPool::global().parallel_for(interval<int>(prediction.rows), [&](interval<int> rows)
+	{
+		classification_outcome partial;
+		for(int y = rows.start; y < rows.end; y++)
+			countRow(prediction.ptr<uchar>(y), truth.ptr<uchar>(y), fov.data ? fov.ptr<uchar>(y) : 0, prediction.cols, partial);
+		std::unique_lock<std::mutex> lk(lock);
+		out += partial;
+	});
+	return out;
+}
+
+ucas::SegmentationMetrics::SegmentationMetrics(double _score_lo, double _score_hi, int _score_bins) throw (ucas::Error)
+	: score_lo(_score_lo), score_hi(_score_hi), score_bins(_score_bins), scores(_score_lo, _score_hi, _score_bins)
+{
+}
+
+void ucas::SegmentationMetrics::add(const cv::Mat & prediction, const cv::Mat & truth, const cv::Mat & fov) throw (ucas::Error)
+{
+	counts += segmentationOutcome(prediction, truth, fov);
+}
+
+void ucas::SegmentationMetrics::addScores(const cv::Mat & image, const cv::Mat & truth, const cv::Mat & fov) throw (ucas::Error)
+{
+	checkInputs("SegmentationMetrics::addScores", image, truth, fov);
+	if(image.depth() != CV_8U && image.depth() != CV_16U && image.depth() != CV_32F)
+		throw ucas::Error("in SegmentationMetrics::addScores(): unsupported bitdepth: only 8-bit, 16-bit and float score maps are supported");
+
+	std::mutex lock;
+	ucas::ThreadPool::global().parallel_for(interval<int>(image.rows), [&](interval<int> rows)
+	{
+		ml::ROC_histogram partial(score_lo, score_hi, score_bins);
+		if(image.depth() == CV_8U)
+			binRows<uchar>(image, truth, fov, rows, partial);
+		else if(image.depth() == CV_16U)
+			binRows<ushort>(image, truth, fov, rows, partial);
+		else
+			binRows<float>(image, truth, fov, rows, partial);
+		std::unique_lock<std::mutex> lk(lock);
+		scores.merge(partial);
+	});
+}
+
+void ucas::SegmentationMetrics::merge(const SegmentationMetrics & m) throw (ucas::Error)
+{
+	scores.merge(m.scores);
+	counts += m.counts;
+}
@@ -0,0 +1,49 @@
+#ifndef _UCAS_EVALUATION_UTILS_H
+#define _UCAS_EVALUATION_UTILS_H
+
+#include <opencv2/core/core.hpp>
+#include "ucasExceptions.h"
+#include "ucasMachineLearningUtils.h"
+
+/*****************************************************************
+*   Segmentation evaluation against manual annotations           *
+******************************************************************/
+namespace ucas
+{
+	// TP / FN / FP / TN of a binary 'prediction' against the 'truth' annotation within 'fov' (all 8-bit single channel, nonzero = foreground)
+	// the whole image is evaluated if 'fov' is empty
+	classification_outcome segmentationOutcome(const cv::Mat & prediction, const cv::Mat & truth, const cv::Mat & fov = cv::Mat()) throw (ucas::Error);
+
+	// Accumulates the segmentation outcome (sensitivity, specificity, accuracy,
+	// Dice, MCC, ...) and the binned ROC of probability maps over any number
+	// of images. Accumulators filled by different threads can be merged, so a
+	// whole test set is evaluated while its images are being segmented.
+	class SegmentationMetrics
+	{
+		public:
+
+			// probability maps are binned in [score_lo, score_hi) (default: one bin per 8-bit value)
+			SegmentationMetrics(double score_lo = 0, double score_hi = 256, int score_bins = 256) throw (ucas::Error);
+
+			// count a binary prediction (8-bit) against 'truth' within 'fov'
+			void add(const cv::Mat & prediction, const cv::Mat & truth, const cv::Mat & fov = cv::Mat()) throw (ucas::Error);
+
+			// count the scores of a probability map (8-bit, 16-bit or float) against 'truth' within 'fov' for the ROC / AUC
+			void addScores(const cv::Mat & scores, const cv::Mat & truth, const cv::Mat & fov = cv::Mat()) throw (ucas::Error);
+
+			void merge(const SegmentationMetrics & m) throw (ucas::Error);
+
+			const classification_outcome & outcome() const { return counts; }
+			const ml::ROC_histogram & roc() const { return scores; }
+			double auc() const throw (ucas::Error) { return scores.AUC(); }
+
+		private:
+
+			double score_lo, score_hi;
+			int score_bins;
+			classification_outcome counts;
+			ml::ROC_histogram scores;
+	};
+}
+
+#endif
@@ -3,41 +3,506 @@
 #include "ucasFileUtils.h"
 #include "ucasLog.h"
 #include "ucasTypes.h"
+#include "ucasMultithreading.h"
+#include "ucasDicomUtils.h"
 
 #ifdef WITH_GDCM
 #include "gdcmImage.h"
 #include "gdcmImageReader.h"
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UCAS_IMAGE_SSE2
+#endif
+
 namespace
 {
-	// image histogram statistics
-	inline double A(const std::vector<int> &y, int j=-1) 
+	// Cumulative tables of one histogram from which every automatic threshold is computed
+	// in O(bins): counts and first/second moments for Mean, Otsu, IsoData and MinError,
+	// and prefix/suffix sums of p*log(p), sqrt(p) and p^2 of the normalized histogram for
+	// the entropy methods and Yen, which would otherwise rescan the histogram at each level.
+	// Moments are accumulated in 64 bits: the former 'int' sums of i*data[i] and i*i*data[i]
+	// overflowed on large images, so Mean, Otsu, IsoData and MinError may differ from the old
+	// results there (they agree wherever the old sums did not overflow)
+	class ThresholdTables
+	{
+		public:
+
+			ThresholdTables(const std::vector<int> & data);
+
+			int mean() const;
+			int otsu() const;
+			int isoData() const;
+			int minErrorI() const;
+			int maxEntropy() const;
+			int renyiEntropy() const;
+			int yen() const;
+
+		private:
+
+			int L;							// number of bins
+			std::vector<long long> N, S;	// sum of data[k] and k*data[k] for k <= i
+			std::vector<double> S2;			// sum of k*k*data[k] for k <= i
+			std::vector<double> P1, P2;		// cumulative normalized histogram and its complement
+			std::vector<double> H1, R1, Q1;	// sum of p*log(p), sqrt(p), p*p for k <= i
+			std::vector<double> H2, R2, Q2;	// same for k > i
+			std::vector<double> F2;			// sum of p for k > i and p > 0
+			int first_bin, last_bin;		// first and last bins with data on both sides
+
+			// Glasbey's A, B, C statistics up to bin 'j' (whole histogram if 'j' is out of range)
+			double A(int j=-1) const { return double(N[j < 0 || j >= L ? L-1 : j]); }
+			double B(int j=-1) const { return double(S[j < 0 || j >= L ? L-1 : j]); }
+			double C(int j=-1) const { return S2[j < 0 || j >= L ? L-1 : j]; }
+
+			// Maximum Entropy criterion at threshold 'it'
+			double entropy(int it) const;
+
+			// maximum of 'criterion' over [first_bin, last_bin], starting from 'threshold' and 'max_crit'
+			template <class F>
+			int argmax(F criterion, int threshold, double max_crit) const
+			{
+				for(int it = first_bin; it <= last_bin; it++)
+				{
+					const double crit = criterion(it);
+					if(crit > max_crit)
+					{
+						max_crit = crit;
+						threshold = it;
+					}
+				}
+				return threshold;
+			}
+	};
+
+	ThresholdTables::ThresholdTables(const std::vector<int> & data) : L(int(data.size()))
+	{
+		N.resize(L);
+		S.resize(L);
+		S2.resize(L);
+		P1.resize(L);
+		P2.resize(L);
+		H1.resize(L);
+		R1.resize(L);
+		Q1.resize(L);
+		H2.resize(L);
+		R2.resize(L);
+		Q2.resize(L);
+		F2.resize(L);
+
+		long long n = 0, s = 0;
+		double s2 = 0;
+		for(int i = 0; i < L; i++)
+		{
+			n += data[i];
+			s += (long long)(i) * data[i];
+			s2 += double(i) * i * data[i];
+			N[i] = n;
+			S[i] = s;
+			S2[i] = s2;
+		}
+
+		// normalized histogram, summed in the same order as the original ImageJ methods
+		const double total = double(n);
+		std::vector<double> norm_histo(L);
+		for(int i = 0; i < L; i++)
+			norm_histo[i] = data[i] / total;
+		double p1 = 0, h1 = 0, r1 = 0, q1 = 0;
+		for(int i = 0; i < L; i++)
+		{
+			const double p = norm_histo[i];
+			p1 = i ? p1 + p : p;
+			P1[i] = p1;
+			P2[i] = 1.0 - p1;
+			h1 += data[i] ? p * std::log(p) : 0.0;
+			r1 += std::sqrt(p);
+			q1 = i ? q1 + p * p : p * p;
+			H1[i] = h1;
+			R1[i] = r1;
+			Q1[i] = q1;
+		}
+		double h2 = 0, r2 = 0, q2 = 0, f2 = 0;
+		for(int i = L - 1; i >= 0; i--)
+		{
+			H2[i] = h2;
+			R2[i] = r2;
+			Q2[i] = q2;
+			F2[i] = f2;
+			const double p = norm_histo[i];
+			h2 += data[i] ? p * std::log(p) : 0.0;
+			r2 += std::sqrt(p);
+			q2 += p * p;
+			f2 += data[i] ? p : 0.0;
+		}
+
+		// determine the first and last non-zero bins
+		first_bin = 0;
+		for(int ih = 0; ih < L; ih++)
+			if(!(ucas::abs(P1[ih]) < 2.220446049250313E-16))
+			{
+				first_bin = ih;
+				break;
+			}
+		last_bin = L - 1;
+		for(int ih = L - 1; ih >= first_bin; ih--)
+			if(!(ucas::abs(P2[ih]) < 2.220446049250313E-16))
+			{
+				last_bin = ih;
+				break;
+			}
+	}
+
+	// entropy of the background plus entropy of the object pixels, where
+	// -sum (p/P) log(p/P) = -(sum p log(p) - log(P) sum p) / P
+	double ThresholdTables::entropy(int it) const
 	{
-		if(j < 0 || j >= y.size())
-			j = int(y.size())-1;
-		double x = 0;
-		for (int i=0;i<=j;i++)
-			x+=y[i];
-		return x;
+		const double ent_back = P1[it] > 0 ? -(H1[it] - std::log(P1[it]) * P1[it]) / P1[it] : 0.0;
+		const double ent_obj = F2[it] > 0 ? -(H2[it] - std::log(P2[it]) * F2[it]) / P2[it] : 0.0;
+		return ent_back + ent_obj;
 	}
-	inline double B(const std::vector<int> &y, int j=-1) 
+
+	int ThresholdTables::mean() const
 	{
-		if(j < 0 || j >= y.size())
-			j = int(y.size())-1;
-		double x = 0;
-		for (int i=0;i<=j;i++)
-			x+=i*y[i];
-		return x;
+		// C. A. Glasbey, "An analysis of histogram-based thresholding algorithms,"
+		// CVGIP: Graphical Models and Image Processing, vol. 55, pp. 532-537, 1993.
+		//
+		// The threshold is the mean of the greyscale data
+		return static_cast<int> ( std::floor(B()/A()) );
+	}
+
+	int ThresholdTables::otsu() const
+	{
+		// Otsu's threshold algorithm
+		// C++ code by Jordan Bevik <Jordan.Bevic@qtiworld.com>
+		// ported to ImageJ plugin by G.Landini
+		const double n = double(N[L-1]), s = double(S[L-1]);
+		double BCVmax = 0;
+		int kStar = 0;
+
+		// Look at each possible threshold value,
+		// calculate the between-class variance, and decide if it's a max
+		for(int k = 1; k < L-1; k++)	// No need to check endpoints k = 0 or k = L-1
+		{
+			// N1 = # points with intensity <= k, Sk = total intensity of those points
+			const double N1 = double(N[k]), Sk = double(S[k]);
+			const double denom = N1 * (n - N1);
+			double BCV = 0;
+			if(denom != 0)
+			{
+				const double num = (N1 / n) * s - Sk;
+				BCV = (num * num) / denom;
+			}
+			if(BCV >= BCVmax)
+			{
+				BCVmax = BCV;
+				kStar = k;
+			}
+		}
+		return kStar;
 	}
-	inline double C(const std::vector<int> &y, int j=-1) 
+
+	int ThresholdTables::isoData() const
 	{
-		if(j < 0 || j >= y.size())
-			j = int(y.size())-1;
-		double x = 0;
-		for (int i=0;i<=j;i++)
-			x+=i*i*y[i];
-		return x;
+		// IMPLEMENTATION: taken from ImageJ
+		int g = 0;
+		for(int i = 1; i < L; i++)
+			if(N[i] > N[i-1])
+			{
+				g = i + 1;
+				break;
+			}
+		while(true)
+		{
+			// bins below g and above g
+			const long long totl = g > 0 ? N[std::min(g, L) - 1] : 0;
+			const long long l = g > 0 ? S[std::min(g, L) - 1] : 0;
+			const long long toth = g + 1 < L ? N[L-1] - N[g] : 0;
+			const long long h = g + 1 < L ? S[L-1] - S[g] : 0;
+			if(totl > 0 && toth > 0)
+			{
+				if(g == ucas::round((l / totl + h / toth) / 2.0))
+					break;
+			}
+			g++;
+			if(g > L-2)
+			{
+				ucas::warning("IsoData Threshold not found.");
+				return -1;
+			}
+		}
+		return g;
+	}
+
+	int ThresholdTables::minErrorI() const
+	{
+		//Initial estimate for the threshold is found with the MEAN algorithm.
+		int threshold = mean();
+		int Tprev =-2;
+		double mu, nu, p, q, sigma2, tau2, w0, w1, w2, sqterm, temp;
+		while (threshold!=Tprev)
+		{
+			//Calculate some statistics.
+			mu = B(threshold)/A(threshold);
+			nu = (B()-B(threshold))/(A()-A(threshold));
+			p = A(threshold)/A();
+			q = (A()-A(threshold)) / A();
+			sigma2 = C(threshold)/A(threshold)-(mu*mu);
+			tau2 = (C()-C(threshold)) / (A()-A(threshold)) - (nu*nu);
+
+			//The terms of the quadratic equation to be solved.
+			w0 = 1.0/sigma2-1.0/tau2;
+			w1 = mu/sigma2-nu/tau2;
+			w2 = (mu*mu)/sigma2 - (nu*nu)/tau2 + std::log10((sigma2*(q*q))/(tau2*(p*p)));
+
+			//If the next threshold would be imaginary, return with the current one.
+			sqterm = (w1*w1)-w0*w2;
+			if (sqterm < 0) {
+				ucas::warning("MinError(I): not converging. Try \'Ignore black/white\' options");
+				return threshold;
+			}
+
+			//The updated threshold is the integer part of the solution of the quadratic equation.
+			Tprev = threshold;
+			temp = (w1+std::sqrt(sqterm))/w0;
+
+			if ( ucas::is_nan(temp)) {
+				ucas::warning("MinError(I): NaN, not converging. Try \'Ignore black/white\' options");
+				threshold = Tprev;
+			}
+			else
+				threshold =(int) std::floor(temp);
+		}
+		return threshold;
+	}
+
+	int ThresholdTables::maxEntropy() const
+	{
+		// Calculate the total entropy each gray-level
+		// and find the threshold that maximizes it
+		return argmax([this](int it){ return entropy(it); }, -1, -std::numeric_limits<double>::max());
+	}
+
+	int ThresholdTables::renyiEntropy() const
+	{
+		// thresholds (was MIN_INT in original code, but if an empty image is processed it gives an error later on)
+		// - maximum entropy (alpha = 1)
+		int t_star2 = argmax([this](int it){ return entropy(it); }, 0, 0.0);
+
+		// - alpha = 0.5: sum sqrt(p/P) = sum sqrt(p) / sqrt(P)
+		int t_star1 = argmax([this](int it)
+		{
+			const double ent_back = R1[it] / std::sqrt(P1[it]), ent_obj = R2[it] / std::sqrt(P2[it]);
+			return 2.0 * ( ( ent_back * ent_obj ) > 0.0 ? std::log ( ent_back * ent_obj ) : 0.0);
+		}, 0, 0.0);
+
+		// - alpha = 2: sum (p/P)^2 = sum p^2 / P^2
+		int t_star3 = argmax([this](int it)
+		{
+			const double ent_back = Q1[it] / ( P1[it] * P1[it] ), ent_obj = Q2[it] / ( P2[it] * P2[it] );
+			return -1.0 * ( ( ent_back * ent_obj ) > 0.0 ? std::log(ent_back * ent_obj ) : 0.0 );
+		}, 0, 0.0);
+
+		/* Sort t_star values */
+		if ( t_star2 < t_star1 )
+			std::swap(t_star1, t_star2);
+		if ( t_star3 < t_star2 )
+			std::swap(t_star2, t_star3);
+		if ( t_star2 < t_star1 )
+			std::swap(t_star1, t_star2);
+
+		/* Adjust beta values */
+		int beta1, beta2, beta3;
+		if ( std::abs ( t_star1 - t_star2 ) <= 5 )  {
+			if ( std::abs ( t_star2 - t_star3 ) <= 5 ) {
+				beta1 = 1;
+				beta2 = 2;
+				beta3 = 1;
+			}
+			else {
+				beta1 = 0;
+				beta2 = 1;
+				beta3 = 3;
+			}
+		}
+		else {
+			if ( std::abs ( t_star2 - t_star3 ) <= 5 ) {
+				beta1 = 3;
+				beta2 = 1;
+				beta3 = 0;
+			}
+			else {
+				beta1 = 1;
+				beta2 = 2;
+				beta3 = 1;
+			}
+		}
+
+		/* Determine the optimal threshold value */
+		const double omega = P1[t_star3] - P1[t_star1];
+		return (int) (t_star1 * ( P1[t_star1] + 0.25 * omega * beta1 ) + 0.25 * t_star2 * omega * beta2  + t_star3 * ( P2[t_star3] + 0.25 * omega * beta3 ));
+	}
+
+	int ThresholdTables::yen() const
+	{
+		/* Find the threshold that maximizes the criterion */
+		int threshold = -1;
+		double max_crit = -std::numeric_limits<double>::max();
+		for(int it = 0; it < L; it++)
+		{
+			const double crit = -1.0 * (( Q1[it] * Q2[it] )> 0.0? std::log( Q1[it] * Q2[it]):0.0) +  2 * ( ( P1[it] * ( 1.0 - P1[it] ) )>0.0? std::log(  P1[it] * ( 1.0 - P1[it] ) ): 0.0);
+			if ( crit > max_crit ) {
+				max_crit = crit;
+				threshold = it;
+			}
+		}
+		return threshold;
+	}
+
+	inline int popcount16(unsigned int x)
+	{
+		x = x - ((x >> 1) & 0x5555);
+		x = (x & 0x3333) + ((x >> 2) & 0x3333);
+		x = (x + (x >> 4)) & 0x0F0F;
+		return (x + (x >> 8)) & 0x1F;
+	}
+
+#ifdef UCAS_IMAGE_SSE2
+	// range bounds as compared by inRange16()
+	inline __m128i splat(const ucas::uint8 *, int v)	{ return _mm_set1_epi8(char(v)); }
+	inline __m128i splat(const ucas::uint16 *, int v)	{ return _mm_set1_epi16(short(v ^ 0x8000)); }
+
+	// 0xFF for each of the 16 pixels from 'p' within [lo, hi]
+	inline __m128i inRange16(const ucas::uint8 * p, __m128i lo, __m128i hi)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		return _mm_cmpeq_epi8(_mm_max_epu8(_mm_min_epu8(v, hi), lo), v);
+	}
+	inline __m128i inRange16(const ucas::uint16 * p, __m128i lo, __m128i hi)
+	{
+		// SSE2 has no unsigned 16-bit compare: flip the sign bit and compare signed
+		const __m128i sign = _mm_set1_epi16(short(0x8000));
+		const __m128i a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), sign);
+		const __m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), sign);
+		const __m128i out_a = _mm_or_si128(_mm_cmplt_epi16(a, lo), _mm_cmpgt_epi16(a, hi));
+		const __m128i out_b = _mm_or_si128(_mm_cmplt_epi16(b, lo), _mm_cmpgt_epi16(b, hi));
+		return _mm_andnot_si128(_mm_packs_epi16(out_a, out_b), _mm_set1_epi8(-1));
+	}
+#endif
+
+	// binarize one row against [lo, hi] (no foreground if 'empty'), returns the number of pixels set
+	template <typename T>
+	size_t binarizeRow(const T * src, ucas::uint8 * dst, int n, int lo, int hi, bool empty, bool inverted, bool packed, int * histo)
+	{
+		size_t count = 0;
+		int x = 0;
+#ifdef UCAS_IMAGE_SSE2
+		const __m128i vlo = splat(src, lo), vhi = splat(src, hi);
+		const __m128i keep = _mm_set1_epi8(empty ? 0 : -1), flip = _mm_set1_epi8(inverted ? -1 : 0);
+		for(; x <= n - 16; x += 16)
+		{
+			const __m128i m = _mm_xor_si128(_mm_and_si128(inRange16(src + x, vlo, vhi), keep), flip);
+			const unsigned int bits = _mm_movemask_epi8(m);
+
+			// count the input before storing the output, which may overwrite it ('dst' may be 'src')
+			if(histo)
+				for(int k = 0; k < 16; k++)
+					histo[src[x + k]]++;
+			if(packed)
+			{
+				dst[x / 8] = ucas::uint8(bits);
+				dst[x / 8 + 1] = ucas::uint8(bits >> 8);
+			}
+			else
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), m);
+			count += popcount16(bits);
+		}
+#endif
+		for(; x < n; x++)
+		{
+			const bool fg = (!empty && src[x] >= lo && src[x] <= hi) != inverted;
+			if(histo)
+				histo[src[x]]++;
+			if(packed)
+			{
+				if(x % 8 == 0)
+					dst[x / 8] = 0;
+				dst[x / 8] |= ucas::uint8(fg) << (x % 8);
+			}
+			else
+				dst[x] = fg ? 255 : 0;
+			count += fg;
+		}
+		return count;
+	}
+
+	// count the gray levels of 'rows' into 'banks' interleaved histograms of 'levels'+1 counters each: consecutive pixels,
+	// often equal, go to different banks so their increments do not wait on each other; the last counter of each
+	// bank collects the pixels outside the mask
+	template <typename T, int banks>
+	void countLevels(const cv::Mat & image, const cv::Mat & mask, ucas::interval<int> rows, int levels, int * counts)
+	{
+		const int stride = levels + 1;
+		int * h[banks];
+		for(int b = 0; b < banks; b++)
+			h[b] = counts + b * stride;
+
+		for(int y = rows.start; y < rows.end; y++)
+		{
+			const T * p = image.ptr<T>(y);
+			const ucas::uint8 * m = mask.data ? mask.ptr<ucas::uint8>(y) : 0;
+			const int n = image.cols;
+			int x = 0;
+			if(m)
+			{
+				for(; x <= n - banks; x += banks)
+					for(int b = 0; b < banks; b++)
+						h[b][m[x + b] ? p[x + b] : levels]++;
+				for(; x < n; x++)
+					h[0][m[x] ? p[x] : levels]++;
+			}
+			else
+			{
+				for(; x <= n - banks; x += banks)
+					for(int b = 0; b < banks; b++)
+						h[b][p[x + b]]++;
+				for(; x < n; x++)
+					h[0][p[x]]++;
+			}
+		}
+	}
+
+	// dst(x,y) = table[src(x,y)] on every channel, in bands of rows on the global thread pool;
+	// loads are issued four at a time so that the table lookups of a group overlap
+	template <typename TI, typename TO>
+	void remapRows(const cv::Mat & src, cv::Mat & dst, const unsigned short* table)
+	{
+		const int n = src.cols * src.channels();
+		auto remap = [&](ucas::interval<int> rows)
+		{
+			for(int y = rows.start; y < rows.end; y++)
+			{
+				const TI* s = src.ptr<TI>(y);
+				TO* d = dst.ptr<TO>(y);
+				int x = 0;
+				for(; x <= n - 4; x += 4)
+				{
+					const TO a = TO(table[s[x]]), b = TO(table[s[x+1]]), c = TO(table[s[x+2]]), e = TO(table[s[x+3]]);
+					d[x] = a;
+					d[x+1] = b;
+					d[x+2] = c;
+					d[x+3] = e;
+				}
+				for(; x < n; x++)
+					d[x] = TO(table[s[x]]);
+			}
+		};
+
+		// bands of at least 64K samples, so that small images stay on the calling thread
+		const int grain = std::max(1, (1 << 16) / std::max(1, n));
+		if(src.rows > grain)
+			ucas::ThreadPool::global().parallel_for(ucas::interval<int>(src.rows), remap, grain);
+		else
+			remap(ucas::interval<int>(src.rows));
 	}
 }
 
@@ -82,12 +547,24 @@ cv::Mat ucas::imread(const std::string & path, int flags, int *bits_used) throw
 	if(!ucas::isFile(path))
 		throw ucas::FileNotExistsError(path);
 
-	// check for DICOM extension and try to load with GDCM library, if present
+	// check for DICOM extension and try to load with the built-in parser or with GDCM library, if present
 	if(ucas::getFileExtension(path) == "dcm" || ucas::getFileExtension(path) == "DCM")
 	{
 
 #ifdef WITH_GDCM
 
+		// uncompressed images are mapped in memory and returned as a view of their pixel data, without decoding
+		// nor copying; GDCM is used for all the other ones, and for headers the built-in parser cannot handle
+		try
+		{
+			cv::Mat mapped = ucas::dicomMap(path, bits_used);
+			if(mapped.data)
+				return mapped;
+		}
+		catch(ucas::Error &)
+		{
+		}
+
 		// read file
 		gdcm::ImageReader imreader;
 		imreader.SetFileName( path.c_str() );
@@ -117,7 +594,13 @@ cv::Mat ucas::imread(const std::string & path, int flags, int *bits_used) throw
 
 		return mat;
 #else
-		throw ucas::Error("Cannot read DICOM file: GDCM library not found. Please re-configure the build from source and enable GDCM.");
+
+		// built-in parser only: uncompressed images are mapped in memory, compressed ones need GDCM
+		cv::Mat mapped = ucas::dicomMap(path, bits_used);
+		if(!mapped.data)
+			throw ucas::Error(ucas::strprintf("Cannot read DICOM file \"%s\": without GDCM only uncompressed little endian, 8- or 16-bit "
+				"unsigned, single-frame grayscale images are supported. Please re-configure the build from source and enable GDCM.", path.c_str()));
+		return mapped;
 #endif
 	}
 
@@ -130,20 +613,11 @@ cv::Mat ucas::imread(const std::string & path, int flags, int *bits_used) throw
 // rescale the image from 'bits_in' to 'bits_out'
 void ucas::imrescale(cv::Mat & image, int bits_in, int bits_out) throw (ucas::Error)
 {
-	if(image.depth() == CV_8U)
-	{
-		if(bits_out > 8)
-			throw ucas::Error(ucas::strprintf("Cannot rescale image: bits_out (%d) > stored bits (8)", bits_out));
-		float f = (std::pow(2.0f, bits_out) - 1.0f) / ( std::pow(2.0f, bits_in) -1.0f);
-		int max = int(std::pow(2.0f, bits_out) - 1);
-		for(int y=0; y<image.rows; y++)
-		{
-			unsigned char* data = image.ptr<unsigned char>(y);
-			for(int x=0; x<image.cols; x++)
-				data[x] = (unsigned char)(std::min ( ucas::round( data[x] * f ), max ) );
-		}
-	}
-	if(image.depth() == CV_16U)
+	if(image.depth() != CV_8U && image.depth() != CV_16U)
+		return;
+
+	// the 64K entries table of 16-bit images only pays off on images with at least as many samples
+	if(image.depth() == CV_16U && image.total() * image.channels() < 65536)
 	{
 		if(bits_out > 16)
 			throw ucas::Error(ucas::strprintf("Cannot rescale image: bits_out (%d) > stored bits (16)", bits_out));
@@ -152,10 +626,96 @@ void ucas::imrescale(cv::Mat & image, int bits_in, int bits_out) throw (ucas::Er
 		for(int y=0; y<image.rows; y++)
 		{
 			unsigned short* data = image.ptr<unsigned short>(y);
-			for(int x=0; x<image.cols; x++)
+			for(int x=0; x<image.cols*image.channels(); x++)
 				data[x] = (unsigned short)(std::min ( ucas::round( data[x] * f ), max ) );
 		}
 	}
+	else
+		PointLUT::rescale(image.depth(), bits_in, bits_out).apply(image, image);
+}
+
+// identity table, saturated to the output depth
+ucas::PointLUT::PointLUT(int depth_in, int depth_out) throw (ucas::Error) : din(depth_in), dout(depth_out)
+{
+	if((din != CV_8U && din != CV_16U) || (dout != CV_8U && dout != CV_16U))
+		throw ucas::Error("in PointLUT(): unsupported bitdepth: only 8- and 16-bit images are supported");
+	table.resize(din == CV_8U ? 256 : 65536);
+	const int maxval = dout == CV_8U ? 255 : 65535;
+	for(int v = 0; v < int(table.size()); v++)
+		table[v] = static_cast<unsigned short>(std::min(v, maxval));
+}
+
+// composition of two tables
+ucas::PointLUT ucas::PointLUT::then(const ucas::PointLUT & next) const throw (ucas::Error)
+{
+	if(next.din != dout)
+		throw ucas::Error("in PointLUT::then(): the input depth of the next table differs from the output depth of this one");
+	PointLUT lut(din, next.dout);
+	for(size_t v = 0; v < table.size(); v++)
+		lut.table[v] = next.table[table[v]];
+	return lut;
+}
+
+// dst = table[src], in a single pass
+void ucas::PointLUT::apply(const cv::Mat & src, cv::Mat & dst) const throw (ucas::Error)
+{
+	if(!src.data)
+		throw ucas::Error("in PointLUT::apply(): invalid image");
+	if(src.depth() != din)
+		throw ucas::Error(ucas::strprintf("in PointLUT::apply(): image depth (%d bits) differs from the table input depth (%d bits)",
+			ucas::imdepth(src.depth()), ucas::imdepth(din)));
+
+	// keep a reference to the input: 'dst' may be 'src' and be reallocated
+	const cv::Mat in = src;
+	dst.create(in.size(), CV_MAKETYPE(dout, in.channels()));
+	if(din == CV_8U && dout == CV_8U)
+		remapRows<ucas::uint8, ucas::uint8>(in, dst, &table[0]);
+	else if(din == CV_8U)
+		remapRows<ucas::uint8, ucas::uint16>(in, dst, &table[0]);
+	else if(dout == CV_8U)
+		remapRows<ucas::uint16, ucas::uint8>(in, dst, &table[0]);
+	else
+		remapRows<ucas::uint16, ucas::uint16>(in, dst, &table[0]);
+}
+
+// imrescale() as a table: same float expression, hence the same results
+ucas::PointLUT ucas::PointLUT::rescale(int depth, int bits_in, int bits_out) throw (ucas::Error)
+{
+	const int stored = depth == CV_8U ? 8 : 16;
+	if(bits_out > stored)
+		throw ucas::Error(ucas::strprintf("Cannot rescale image: bits_out (%d) > stored bits (%d)", bits_out, stored));
+	const float f = (std::pow(2.0f, bits_out) - 1.0f) / ( std::pow(2.0f, bits_in) -1.0f);
+	const int max = int(std::pow(2.0f, bits_out) - 1);
+	return compile(depth, depth, [f, max](int v){ return std::min ( ucas::round( v * f ), max ); });
+}
+
+// binarization as a table
+ucas::PointLUT ucas::PointLUT::threshold(int depth_in, int lo, int hi, bool inverted) throw (ucas::Error)
+{
+	return compile(depth_in, CV_8U, [lo, hi, inverted](int v){ return (v >= lo && v <= hi) != inverted ? 255 : 0; });
+}
+
+// cv::convertScaleAbs() as a table (single precision, as OpenCV)
+ucas::PointLUT ucas::PointLUT::scaleAbs(int depth_in, int depth_out, double alpha, double beta) throw (ucas::Error)
+{
+	const float a = float(alpha), b = float(beta);
+	return compile(depth_in, depth_out, [a, b](int v){ return std::abs(v * a + b); });
+}
+
+// DICOM linear VOI window
+ucas::PointLUT ucas::PointLUT::window(int depth_in, int depth_out, double center, double width) throw (ucas::Error)
+{
+	if(width < 1)
+		throw ucas::Error(ucas::strprintf("in PointLUT::window(): invalid window width %f", width));
+	const double ymax = depth_out == CV_8U ? 255 : 65535;
+	return compile(depth_in, depth_out, [center, width, ymax](int v)
+	{
+		if(v <= center - 0.5 - (width - 1) / 2)
+			return 0.0;
+		if(v > center - 0.5 + (width - 1) / 2)
+			return ymax;
+		return width > 1 ? ((v - (center - 0.5)) / (width - 1) + 0.5) * ymax : ymax;
+	});
 }
 
 std::string ucas::binarizationMethod_toString(ucas::binarizationMethod code)
@@ -188,402 +748,34 @@ std::string ucas::binarizationMethods()
 
 int ucas::getMeanThreshold(const std::vector<int> & data) throw (ucas::Error)
 {
-	// C. A. Glasbey, "An analysis of histogram-based thresholding algorithms,"
-	// CVGIP: Graphical Models and Image Processing, vol. 55, pp. 532-537, 1993.
-	//
-	// The threshold is the mean of the greyscale data
-	return static_cast<int> ( std::floor(B(data)/A(data)) );
+	return ThresholdTables(data).mean();
 }
 
 // Otsu's threshold algorithm
 int ucas::getOtsuAutoThreshold(const std::vector<int> & data) throw (ucas::Error)
 {
-	// Otsu's threshold algorithm
-	// C++ code by Jordan Bevik <Jordan.Bevic@qtiworld.com>
-	// ported to ImageJ plugin by G.Landini
-	int k,kStar;  // k = the current threshold; kStar = optimal threshold
-	int N1, N;    // N1 = # points with intensity <=k; N = total number of points
-	double BCV, BCVmax; // The current Between Class Variance and maximum BCV
-	double num, denom;  // temporary bookeeping
-	int Sk;  // The total intensity for all histogram points <=k
-	int S, L=int(data.size()); // The total intensity of the image
-
-	// Initialize values:
-	S = N = 0;
-	for (k=0; k<L; k++){
-		S += k * data[k];	// Total histogram intensity
-		N += data[k];		// Total number of data points
-	}
-
-	Sk = 0;
-	N1 = data[0]; // The entry for zero intensity
-	BCV = 0;
-	BCVmax=0;
-	kStar = 0;
-
-	// Look at each possible threshold value,
-	// calculate the between-class variance, and decide if it's a max
-	for (k=1; k<L-1; k++) { // No need to check endpoints k = 0 or k = L-1
-		Sk += k * data[k];
-		N1 += data[k];
-
-		// The float casting here is to avoid compiler warning about loss of precision and
-		// will prevent overflow in the case of large saturated images
-		denom = (double)( N1) * (N - N1); // Maximum value of denom is (N^2)/4 =  approx. 3E10
-
-		if (denom != 0 ){
-			// Float here is to avoid loss of precision when dividing
-			num = ( (double)N1 / N ) * S - Sk; 	// Maximum value of num =  255*N = approx 8E7
-			BCV = (num * num) / denom;
-		}
-		else
-			BCV = 0;
-
-		if (BCV >= BCVmax){ // Assign the best threshold found so far
-			BCVmax = BCV;
-			kStar = k;
-		}
-	}
-	// kStar += 1;	// Use QTI convention that intensity -> 1 if intensity >= k
-	// (the algorithm was developed for I-> 1 if I <= k.)
-	return kStar;
+	return ThresholdTables(data).otsu();
 }
 
 //Yen J.C., Chang F.J., and Chang S. (1995) 
 // "A New Criterion for Automatic Multilevel Thresholding" IEEE Trans. on Image Processing, 4(3): 370-378
 int ucas::getYenyAutoThreshold(const std::vector<int> & data) throw (ucas::Error)
 {
-	int threshold;
-	int ih, it;
-	double crit;
-	double max_crit;
-	double * norm_histo = new double[data.size()]; /* normalized histogram */
-	double * P1 = new double[data.size()]; /* cumulative normalized histogram */
-	double * P1_sq = new double[data.size()];
-	double * P2_sq = new double[data.size()];
-
-	int total =0;
-	for (ih = 0; ih < data.size(); ih++ )
-		total+=data[ih];
-
-	for (ih = 0; ih < data.size(); ih++ )
-		norm_histo[ih] = (double)data[ih]/total;
-
-	P1[0]=norm_histo[0];
-	for (ih = 1; ih < data.size(); ih++ )
-		P1[ih]= P1[ih-1] + norm_histo[ih];
-
-	P1_sq[0]=norm_histo[0]*norm_histo[0];
-	for (ih = 1; ih < data.size(); ih++ )
-		P1_sq[ih]= P1_sq[ih-1] + norm_histo[ih] * norm_histo[ih];
-
-	P2_sq[data.size() - 1] = 0.0;
-	for ( ih = int(data.size())-2; ih >= 0; ih-- )
-		P2_sq[ih] = P2_sq[ih + 1] + norm_histo[ih + 1] * norm_histo[ih + 1];
-
-	/* Find the threshold that maximizes the criterion */
-	threshold = -1;
-	max_crit = -std::numeric_limits<double>::max();
-	for ( it = 0; it < data.size(); it++ ) {
-		crit = -1.0 * (( P1_sq[it] * P2_sq[it] )> 0.0? std::log( P1_sq[it] * P2_sq[it]):0.0) +  2 * ( ( P1[it] * ( 1.0 - P1[it] ) )>0.0? std::log(  P1[it] * ( 1.0 - P1[it] ) ): 0.0);
-		if ( crit > max_crit ) {
-			max_crit = crit;
-			threshold = it;
-		}
-	}
-
-	delete[] norm_histo;
-	delete[] P1;
-	delete[] P1_sq;
-	delete[] P2_sq;
-
-	return threshold;
+	return ThresholdTables(data).yen();
 }
 
 // Kapur J.N., Sahoo P.K., and Wong A.K.C. (1985) 
 // "A New Method for Gray-Level Picture Thresholding Using the Entropy of the Histogram" Graphical Models and Image Processing, 29(3): 273-285
 int ucas::getRenyiEntropyAutoThreshold(const std::vector<int> & data) throw (ucas::Error)
 {
-	int threshold; 
-	int opt_threshold;
-
-	int ih, it;
-	int first_bin;
-	int last_bin;
-	int tmp_var;
-	int t_star1, t_star2, t_star3;
-	int beta1, beta2, beta3;
-	double alpha;/* alpha parameter of the method */
-	double term;
-	double tot_ent;  /* total entropy */
-	double max_ent;  /* max entropy */
-	double ent_back; /* entropy of the background pixels at a given threshold */
-	double ent_obj;  /* entropy of the object pixels at a given threshold */
-	double omega;
-	double * norm_histo = new double[data.size()]; /* normalized histogram */
-	double * P1 = new double[data.size()]; /* cumulative normalized histogram */
-	double * P2 = new double[data.size()];
-
-	int total =0;
-	for (ih = 0; ih < data.size(); ih++ )
-		total+=data[ih];
-
-	for (ih = 0; ih < data.size(); ih++ )
-		norm_histo[ih] = (double)data[ih]/total;
-
-	P1[0]=norm_histo[0];
-	P2[0]=1.0-P1[0];
-	for (ih = 1; ih < data.size(); ih++ ){
-		P1[ih]= P1[ih-1] + norm_histo[ih];
-		P2[ih]= 1.0 - P1[ih];
-	}
-
-	/* Determine the first non-zero bin */
-	first_bin=0;
-	for (ih = 0; ih < data.size(); ih++ ) {
-		if ( !(ucas::abs(P1[ih])<2.220446049250313E-16)) {
-			first_bin = ih;
-			break;
-		}
-	}
-
-	/* Determine the last non-zero bin */
-	last_bin=int(data.size()) - 1;
-	for (ih = int(data.size()) - 1; ih >= first_bin; ih-- ) {
-		if ( !(ucas::abs(P2[ih])<2.220446049250313E-16)) {
-			last_bin = ih;
-			break;
-		}
-	}
-
-	/* Maximum Entropy Thresholding - BEGIN */
-	/* ALPHA = 1.0 */
-	/* Calculate the total entropy each gray-level
-	and find the threshold that maximizes it 
-	*/
-	threshold =0; // was MIN_INT in original code, but if an empty image is processed it gives an error later on.
-	max_ent = 0.0;
-
-	for ( it = first_bin; it <= last_bin; it++ ) {
-		/* Entropy of the background pixels */
-		ent_back = 0.0;
-		for ( ih = 0; ih <= it; ih++ )  {
-			if ( data[ih] !=0 ) {
-				ent_back -= ( norm_histo[ih] / P1[it] ) * std::log ( norm_histo[ih] / P1[it] );
-			}
-		}
-
-		/* Entropy of the object pixels */
-		ent_obj = 0.0;
-		for ( ih = it + 1; ih < data.size(); ih++ ){
-			if (data[ih]!=0){
-			ent_obj -= ( norm_histo[ih] / P2[it] ) * std::log ( norm_histo[ih] / P2[it] );
-			}
-		}
-
-		/* Total entropy */
-		tot_ent = ent_back + ent_obj;
-
-		// IJ.log(""+max_ent+"  "+tot_ent);
-
-		if ( max_ent < tot_ent ) {
-			max_ent = tot_ent;
-			threshold = it;
-		}
-	}
-	t_star2 = threshold;
-
-	/* Maximum Entropy Thresholding - END */
-	threshold =0; //was MIN_INT in original code, but if an empty image is processed it gives an error later on.
-	max_ent = 0.0;
-	alpha = 0.5;
-	term = 1.0 / ( 1.0 - alpha );
-	for ( it = first_bin; it <= last_bin; it++ ) {
-		/* Entropy of the background pixels */
-		ent_back = 0.0;
-		for ( ih = 0; ih <= it; ih++ )
-			ent_back += std::sqrt ( norm_histo[ih] / P1[it] );
-
-		/* Entropy of the object pixels */
-		ent_obj = 0.0;
-		for ( ih = it + 1; ih < data.size(); ih++ )
-			ent_obj += std::sqrt ( norm_histo[ih] / P2[it] );
-
-		/* Total entropy */
-		tot_ent = term * ( ( ent_back * ent_obj ) > 0.0 ? std::log ( ent_back * ent_obj ) : 0.0);
-
-		if ( tot_ent > max_ent ){
-			max_ent = tot_ent;
-			threshold = it;
-		}
-	}
-
-	t_star1 = threshold;
-
-	threshold = 0; //was MIN_INT in original code, but if an empty image is processed it gives an error later on.
-	max_ent = 0.0;
-	alpha = 2.0;
-	term = 1.0 / ( 1.0 - alpha );
-	for ( it = first_bin; it <= last_bin; it++ ) {
-		/* Entropy of the background pixels */
-		ent_back = 0.0;
-		for ( ih = 0; ih <= it; ih++ )
-			ent_back += ( norm_histo[ih] * norm_histo[ih] ) / ( P1[it] * P1[it] );
-
-		/* Entropy of the object pixels */
-		ent_obj = 0.0;
-		for ( ih = it + 1; ih < data.size(); ih++ )
-			ent_obj += ( norm_histo[ih] * norm_histo[ih] ) / ( P2[it] * P2[it] );
-
-		/* Total entropy */
-		tot_ent = term *( ( ent_back * ent_obj ) > 0.0 ? std::log(ent_back * ent_obj ): 0.0 );
-
-		if ( tot_ent > max_ent ){
-			max_ent = tot_ent;
-			threshold = it;
-		}
-	}
-
-	t_star3 = threshold;
-
-	/* Sort t_star values */
-	if ( t_star2 < t_star1 ){
-		tmp_var = t_star1;
-		t_star1 = t_star2;
-		t_star2 = tmp_var;
-	}
-	if ( t_star3 < t_star2 ){
-		tmp_var = t_star2;
-		t_star2 = t_star3;
-		t_star3 = tmp_var;
-	}
-	if ( t_star2 < t_star1 ) {
-		tmp_var = t_star1;
-		t_star1 = t_star2;
-		t_star2 = tmp_var;
-	}
-
-	/* Adjust beta values */
-	if ( std::abs ( t_star1 - t_star2 ) <= 5 )  {
-		if ( std::abs ( t_star2 - t_star3 ) <= 5 ) {
-			beta1 = 1;
-			beta2 = 2;
-			beta3 = 1;
-		}
-		else {
-			beta1 = 0;
-			beta2 = 1;
-			beta3 = 3;
-		}
-	}
-	else {
-		if ( std::abs ( t_star2 - t_star3 ) <= 5 ) {
-			beta1 = 3;
-			beta2 = 1;
-			beta3 = 0;
-		}
-		else {
-			beta1 = 1;
-			beta2 = 2;
-			beta3 = 1;
-		}
-	}
-	//IJ.log(""+t_star1+" "+t_star2+" "+t_star3);
-	/* Determine the optimal threshold value */
-	omega = P1[t_star3] - P1[t_star1];
-	opt_threshold = (int) (t_star1 * ( P1[t_star1] + 0.25 * omega * beta1 ) + 0.25 * t_star2 * omega * beta2  + t_star3 * ( P2[t_star3] + 0.25 * omega * beta3 ));
-
-	delete[] norm_histo;
-	delete[] P1;
-	delete[] P2;
-
-	return opt_threshold;
+	return ThresholdTables(data).renyiEntropy();
 }
 
 // Kapur J.N., Sahoo P.K., and Wong A.K.C. (1985) 
 // "A New Method for Gray-Level Picture Thresholding Using the Entropy of the Histogram" Graphical Models and Image Processing, 29(3): 273-285
 int ucas::getMaxEntropyAutoThreshold(const std::vector<int> & data) throw (ucas::Error)
 {
-	int threshold=-1;
-	int ih, it;
-	int first_bin;
-	int last_bin;
-	double tot_ent;  /* total entropy */
-	double max_ent;  /* max entropy */
-	double ent_back; /* entropy of the background pixels at a given threshold */
-	double ent_obj;  /* entropy of the object pixels at a given threshold */
-	double * norm_histo = new double[data.size()]; /* normalized histogram */
-	double * P1 = new double[data.size()]; /* cumulative normalized histogram */
-	double * P2 = new double[data.size()];
-
-	int total =0;
-	for (ih = 0; ih < data.size(); ih++ )
-		total+=data[ih];
-
-	for (ih = 0; ih < data.size(); ih++ )
-		norm_histo[ih] = (double)data[ih]/total;
-
-	P1[0]=norm_histo[0];
-	P2[0]=1.0-P1[0];
-	for (ih = 1; ih < data.size(); ih++ ){
-		P1[ih]= P1[ih-1] + norm_histo[ih];
-		P2[ih]= 1.0 - P1[ih];
-	}
-
-	/* Determine the first non-zero bin */
-	first_bin=0;
-	for (ih = 0; ih < data.size(); ih++ ) {
-		if ( !(ucas::abs(P1[ih])<2.220446049250313E-16)) {
-			first_bin = ih;
-			break;
-		}
-	}
-
-	/* Determine the last non-zero bin */
-	last_bin=int(data.size()) - 1;
-	for (ih = int(data.size()) - 1; ih >= first_bin; ih-- ) {
-		if ( !(ucas::abs(P2[ih])<2.220446049250313E-16)) {
-			last_bin = ih;
-			break;
-		}
-	}
-
-	// Calculate the total entropy each gray-level
-	// and find the threshold that maximizes it 
-	max_ent = -std::numeric_limits<double>::max();
-
-	for ( it = first_bin; it <= last_bin; it++ ) {
-		/* Entropy of the background pixels */
-		ent_back = 0.0;
-		for ( ih = 0; ih <= it; ih++ )  {
-			if ( data[ih] !=0 ) {
-				ent_back -= ( norm_histo[ih] / P1[it] ) * std::log ( norm_histo[ih] / P1[it] );
-			}
-		}
-
-		/* Entropy of the object pixels */
-		ent_obj = 0.0;
-		for ( ih = it + 1; ih < data.size(); ih++ ){
-			if (data[ih]!=0){
-				ent_obj -= ( norm_histo[ih] / P2[it] ) * std::log ( norm_histo[ih] / P2[it] );
-			}
-		}
-
-		/* Total entropy */
-		tot_ent = ent_back + ent_obj;
-
-		// IJ.log(""+max_ent+"  "+tot_ent);
-		if ( max_ent < tot_ent ) {
-			max_ent = tot_ent;
-			threshold = it;
-		}
-	}
-
-	delete[] norm_histo;
-	delete[] P1;
-	delete[] P2;
-
-	return threshold;
+	return ThresholdTables(data).maxEntropy();
 }
 
 
@@ -591,85 +783,14 @@ int ucas::getMaxEntropyAutoThreshold(const std::vector<int> & data) throw (ucas:
 // C. A. Glasbey, "An analysis of histogram-based thresholding algorithms," CVGIP: Graphical Models and Image Processing, vol. 55, pp. 532-537, 1993.
 int ucas::getMinErrorIThreshold(const std::vector<int> & data) throw (ucas::Error)
 {
-	//Initial estimate for the threshold is found with the MEAN algorithm.
-	int threshold =  getMeanThreshold(data); 
-	int Tprev =-2;
-	double mu, nu, p, q, sigma2, tau2, w0, w1, w2, sqterm, temp;
-	while (threshold!=Tprev)
-	{
-		//Calculate some statistics.
-		mu = B(data, threshold)/A(data, threshold);
-		nu = (B(data)-B(data, threshold))/(A(data)-A(data, threshold));
-		p = A(data, threshold)/A(data);
-		q = (A(data)-A(data, threshold)) / A(data);
-		sigma2 = C(data, threshold)/A(data, threshold)-(mu*mu);
-		tau2 = (C(data)-C(data, threshold)) / (A(data)-A(data, threshold)) - (nu*nu);
-
-
-		//The terms of the quadratic equation to be solved.
-		w0 = 1.0/sigma2-1.0/tau2;
-		w1 = mu/sigma2-nu/tau2;
-		w2 = (mu*mu)/sigma2 - (nu*nu)/tau2 + std::log10((sigma2*(q*q))/(tau2*(p*p)));
-
-		//If the next threshold would be imaginary, return with the current one.
-		sqterm = (w1*w1)-w0*w2;
-		if (sqterm < 0) {
-			ucas::warning("MinError(I): not converging. Try \'Ignore black/white\' options");
-			return threshold;
-		}
-
-		//The updated threshold is the integer part of the solution of the quadratic equation.
-		Tprev = threshold;
-		temp = (w1+std::sqrt(sqterm))/w0;
-
-		if ( ucas::is_nan(temp)) {
-			ucas::warning("MinError(I): NaN, not converging. Try \'Ignore black/white\' options");
-			threshold = Tprev;
-		}
-		else
-			threshold =(int) std::floor(temp);
-	}
-	return threshold;
+	return ThresholdTables(data).minErrorI();
 }
 
 // Iterative procedure based on the isodata algorithm [T.W. Ridler, S. Calvard, Picture 
 // thresholding using an iterative selection method, IEEE Trans. System, Man and Cybernetics, SMC-8 (1978) 630-632.] 
 int ucas::getIsoDataAutoThreshold(const std::vector<int> & data) throw (ucas::Error)
 {
-	// IMPLEMENTATION: taken from ImageJ
-	int i, l, toth, totl, h, g=0;
-	for (i = 1; i < data.size(); i++){
-		if (data[i] > 0){
-			g = i + 1;
-			break;
-		}
-	}
-	while (true){
-		l = 0;
-		totl = 0;
-		for (i = 0; i < g; i++) {
-			totl = totl + data[i];
-			l = l + (data[i] * i);
-		}
-		h = 0;
-		toth = 0;
-		for (i = g + 1; i < data.size(); i++){
-			toth += data[i];
-			h += (data[i]*i);
-		}
-		if (totl > 0 && toth > 0){
-			l /= totl;
-			h /= toth;
-			if (g == (int) round((l + h) / 2.0))
-				break;
-		}
-		g++;
-		if (g >data.size()-2){
-			ucas::warning("IsoData Threshold not found.");
-			return -1;
-		}
-	}
-	return g;
+	return ThresholdTables(data).isoData();
 }
 
 int ucas::getTriangleAutoThreshold(const std::vector<int> & data2) throw (ucas::Error)
@@ -771,9 +892,49 @@ int ucas::getTriangleAutoThreshold(const std::vector<int> & data2) throw (ucas::
 		return split;
 }
 
+// threshold of 'method' among the ones computed by getAllAutoThresholds()
+int ucas::autoThresholds::get(ucas::binarizationMethod method) const throw (ucas::Error)
+{
+	switch(method)
+	{
+		case ucas::mean:			return mean;
+		case ucas::otsu:			return otsu;
+		case ucas::isodata:			return isodata;
+		case ucas::triangle:		return triangle;
+		case ucas::minerror:		return minerror;
+		case ucas::maxentropy:		return maxentropy;
+		case ucas::renyientropy:	return renyientropy;
+		case ucas::yen:				return yen;
+		default: throw ucas::Error(ucas::strprintf("in autoThresholds::get(): \"%s\" is not a histogram thresholding method", binarizationMethod_toString(method).c_str()));
+	}
+}
+
+// every histogram-based threshold from a single set of cumulative tables
+ucas::autoThresholds ucas::getAllAutoThresholds(const std::vector<int> & data) throw (ucas::Error)
+{
+	ThresholdTables tables(data);
+	autoThresholds t;
+	t.mean = tables.mean();
+	t.otsu = tables.otsu();
+	t.isodata = tables.isoData();
+	t.triangle = getTriangleAutoThreshold(data);
+	t.minerror = tables.minErrorI();
+	t.maxentropy = tables.maxEntropy();
+	t.renyientropy = tables.renyiEntropy();
+	t.yen = tables.yen();
+	return t;
+}
+
 // output(x,y) = maxval if input(x,y) > threshold, 0 otherwise
 // *** WARNING *** : binarization is done in place (8-bit output)
 cv::Mat ucas::binarize(cv::Mat & image, int threshold) throw (ucas::Error)
+{
+	binarize(image, image, threshold);
+	return image;
+}
+
+// output(x,y) = 255 on foreground pixels (background if 'inverted'), 0 otherwise, optionally packed and with the input histogram
+size_t ucas::binarize(const cv::Mat & image, cv::Mat & dst, int threshold, binarizationMode mode, int threshold_high, bool inverted, bool packed, std::vector<int> * histo) throw (ucas::Error)
 {
 	// checks
 	if(!image.data)
@@ -783,64 +944,124 @@ cv::Mat ucas::binarize(cv::Mat & image, int threshold) throw (ucas::Error)
 	if(image.depth() != CV_8U && image.depth() != CV_16U)
 		throw ucas::Error("in binarize(): unsupported bitdepth: only 8- and 16-bit grayscale image are supported");
 
+	// every mode is an inclusive range of gray levels
+	const int maxval = image.depth() == CV_8U ? 255 : 65535;
+	int lo = threshold, hi = maxval;
+	if(mode == binarize_greater)
+		lo = threshold + 1;
+	else if(mode == binarize_range)
+		hi = threshold_high;
+	lo = std::max(lo, 0);
+	hi = std::min(hi, maxval);
+	const bool empty = lo > hi;
+	if(empty)
+		lo = hi = 0;
+
+	// keep a reference to the input: 'dst' may be 'image' and be reallocated
+	const cv::Mat src = image;
+	dst.create(src.rows, packed ? (src.cols + 7) / 8 : src.cols, CV_8U);
+	if(histo)
+		histo->assign(maxval + 1, 0);
+	int * h = histo ? &(*histo)[0] : 0;
+
 	// binarization
-	if(image.depth() == CV_8U)
+	size_t count = 0;
+	for(int i=0; i<src.rows; i++)
 	{
-		for(int i=0; i<image.rows; i++)
-		{
-			ucas::uint8* punt = image.ptr<ucas::uint8>(i);
-			for(int j=0; j<image.cols; j++)
-				punt[j] = punt[j] > threshold ? 255 : 0;
-		}
-	}
-	else if(image.depth() == CV_16U)
-	{
-		for(int i=0; i<image.rows; i++)
-		{
-			ucas::uint16* punt = image.ptr<ucas::uint16>(i);
-			for(int j=0; j<image.cols; j++)
-				punt[j] = punt[j] > threshold ? 255 : 0;
-		}
+		if(src.depth() == CV_8U)
+			count += binarizeRow(src.ptr<ucas::uint8>(i), dst.ptr<ucas::uint8>(i), src.cols, lo, hi, empty, inverted, packed, h);
+		else
+			count += binarizeRow(src.ptr<ucas::uint16>(i), dst.ptr<ucas::uint8>(i), src.cols, lo, hi, empty, inverted, packed, h);
 	}
-
-	// conversion
-	if(image.depth() != CV_8U)
-		image.convertTo(image, CV_8U);
-
-	return image;
+	return count;
 }
 
 //return image histogram (the number of bins is automatically set to 2^imgdepth if not provided)
 std::vector<int> ucas::histogram(const cv::Mat & image, int bins /*= -1 */) throw (ucas::Error)
+{
+	std::vector<int> hist;
+	histogram(image, hist, bins);
+	return hist;
+}
+
+// histogram of 'image' within 'mask' into 'hist', optionally accumulated and counted in parallel
+void ucas::histogram(const cv::Mat & image, std::vector<int> & hist, int bins, const cv::Mat & mask, bool accumulate, bool parallel,
+	histogramWorkspace * workspace) throw (ucas::Error)
 {
 	// checks
 	if(!image.data)
 		throw ucas::Error("in histogram(): invalid image");
 	if(image.channels() != 1)
 		throw ucas::Error("in histogram(): unsupported number of channels");
+	if(mask.data && (mask.type() != CV_8UC1 || mask.size() != image.size()))
+		throw ucas::Error("in histogram(): mask must be an 8-bit single channel image of the same size");
 
 	// the number of gray levels
 	int grayLevels  = static_cast<int>( std::pow(2, ucas::imdepth(image.depth())) );
 
 	// computing the number of bins
 	bins = bins == -1 ? grayLevels : bins;
+	if(bins <= 0)
+		throw ucas::Error(ucas::strprintf("in histogram(): invalid number of bins %d", bins));
+	if(accumulate && int(hist.size()) != bins)
+		throw ucas::Error(ucas::strprintf("in histogram(): cannot accumulate %d bins on a %d bins histogram", bins, int(hist.size())));
+	if(!accumulate)
+		hist.assign(bins, 0);
+
+	// other depths: cv::calcHist over [0, 2^imgdepth)
+	if(image.depth() != CV_8U && image.depth() != CV_16U)
+	{
+		int histSize[1]  = {bins};
+		int channels[1]  = {0};
+		float hranges[2] = {0.0f, static_cast<float>(grayLevels)};
+		const float* ranges[1] = {hranges};
+		cv::MatND histo;
+		cv::calcHist(&image, 1, channels, mask, histo, 1, histSize, ranges);
+		for(int i=0; i<bins; i++)
+			hist[i] += static_cast<int>(histo.at<float>(i));
+		return;
+	}
 
-	// input-output parameters of cv::calcHist function
-	int histSize[1]  = {bins};				// number of bins
-	int channels[1]  = {0};					// only 1 channel used here
-	float hranges[2] = {0.0f, static_cast<float>(grayLevels)};	// [min, max) pixel levels to take into account
-	const float* ranges[1] = {hranges};		// [min, max) pixel levels for all the images (here only 1 image)
-	cv::MatND histo;						// where the output histogram is stored
-
-	// histogram computation
-	cv::calcHist(&image, 1, channels, cv::Mat(), histo, 1, histSize, ranges);
-
-	// conversion from MatND to vector<int>
-	std::vector<int> hist;
-	for(int i=0; i<bins; i++)
-		hist.push_back(static_cast<int>(histo.at<float>(i)));
+	// count every gray level (4 banks for 8-bit, 1 for 16-bit where the banks would not fit in cache),
+	// in bands of rows with one set of counters each if parallel
+	const int banks = image.depth() == CV_8U ? 4 : 1;
+	const int stride = grayLevels + 1;
+	const size_t size = size_t(banks) * stride;
+	histogramWorkspace local;
+	histogramWorkspace & ws = workspace ? *workspace : local;
+
+	// bands large enough to pay for their own counters, at most one per thread
+	int n_bands = 1;
+	if(parallel)
+		n_bands = std::max(1, std::min(ucas::ThreadPool::global().size() + 1, image.rows / std::max(1, 4 * int(size) / image.cols)));
+	const int grain = (image.rows + n_bands - 1) / n_bands;
+	n_bands = (image.rows + grain - 1) / grain;
+	if(int(ws.bands.size()) < n_bands)
+		ws.bands.resize(n_bands);
+	auto count = [&](ucas::interval<int> rows)
+	{
+		std::vector<int> & counts = ws.bands[rows.start / grain];
+		counts.assign(size, 0);
+		if(image.depth() == CV_8U)
+			countLevels<ucas::uint8, 4>(image, mask, rows, grayLevels, &counts[0]);
+		else
+			countLevels<ucas::uint16, 1>(image, mask, rows, grayLevels, &counts[0]);
+	};
+	if(n_bands > 1)
+		ucas::ThreadPool::global().parallel_for(ucas::interval<int>(image.rows), count, grain);
+	else
+		count(ucas::interval<int>(image.rows));
 
-	return hist;
+	// merge bands and banks into the requested bins (uniform over [0, 2^imgdepth) as in cv::calcHist)
+	for(int v = 0; v < grayLevels; v++)
+	{
+		int c = 0;
+		for(int k = 0; k < n_bands; k++)
+			for(int b = 0; b < banks; b++)
+				c += ws.bands[k][b * stride + v];
+		if(c)
+			hist[bins == grayLevels ? v : int((long long)(v) * bins / grayLevels)] += c;
+	}
 }
 
 // bracket the histogram to the range that holds data
@@ -860,4 +1081,214 @@ std::vector<int> ucas::compressHistogram(std::vector<int> &histo, int & minbin)
 		data2[i-minbin]= histo[i];
 
 	return data2;
-}
\ No newline at end of file
+}
+
+/*****************************************************************
+*   CLAHE                                                        *
+******************************************************************/
+ucas::CLAHE::CLAHE(double clip_limit, cv::Size tiles) throw (ucas::Error) : clip(clip_limit), grid(tiles), bins(0)
+{
+	if(grid.width < 1 || grid.height < 1)
+		throw ucas::Error(ucas::strprintf("in CLAHE(): invalid tile grid %d x %d", grid.width, grid.height));
+}
+
+// histogram, clipping and cumulative LUT of tile 'tile' of the (padded) image
+template <typename T>
+void ucas::CLAHE::computeLUT(const cv::Mat & image, const cv::Mat & mask, int tile)
+{
+	const cv::Rect roi((tile % grid.width) * tile_size.width, (tile / grid.width) * tile_size.height, tile_size.width, tile_size.height);
+	int * hist = &histograms[size_t(tile) * bins];
+	unsigned short * lut = &luts[size_t(tile) * bins];
+
+	std::fill(hist, hist + bins, 0);
+	int total = 0;
+	for(int y = roi.y; y < roi.y + roi.height; y++)
+	{
+		const T* p = image.ptr<T>(y) + roi.x;
+		if(mask.data)
+		{
+			const ucas::uint8* m = mask.ptr<ucas::uint8>(y) + roi.x;
+			for(int x = 0; x < roi.width; x++)
+				if(m[x])
+				{
+					hist[p[x]]++;
+					total++;
+				}
+		}
+		else
+			for(int x = 0; x < roi.width; x++)
+				hist[p[x]]++;
+	}
+	if(!mask.data)
+		total = roi.area();
+
+	// tile entirely outside the mask: no LUT, interpolate() leaves it out
+	filled[tile] = total > 0;
+	if(!total)
+		return;
+
+	// clip the histogram and redistribute the clipped pixels over all bins,
+	// the remainder one by one to the first bins
+	if(clip > 0)
+	{
+		const int limit = std::max(static_cast<int>(clip * total / bins), 1);
+		int clipped = 0;
+		for(int i = 0; i < bins; i++)
+			if(hist[i] > limit)
+			{
+				clipped += hist[i] - limit;
+				hist[i] = limit;
+			}
+
+		const int batch = clipped / bins;
+		const int residual = clipped - batch * bins;
+		for(int i = 0; i < bins; i++)
+			hist[i] += batch;
+		for(int i = 0; i < residual; i++)
+			hist[i]++;
+	}
+
+	// cumulative histogram scaled to the output range
+	const float scale = static_cast<float>(bins - 1) / total;
+	int sum = 0;
+	for(int i = 0; i < bins; i++)
+	{
+		sum += hist[i];
+		lut[i] = cv::saturate_cast<T>(sum * scale);
+	}
+}
+
+// output rows [y0, y1) interpolated between the LUTs of the 4 nearest tiles
+template <typename T>
+void ucas::CLAHE::interpolate(const cv::Mat & src, cv::Mat & dst, const cv::Mat & mask, int y0, int y1) const
+{
+	const size_t row_stride = size_t(grid.width) * bins;
+	for(int y = y0; y < y1; y++)
+	{
+		const float tyf = static_cast<float>(y) / tile_size.height - 0.5f;
+		int ty1 = cvFloor(tyf);
+		int ty2 = ty1 + 1;
+		const float ya = tyf - ty1;
+		ty1 = std::max(ty1, 0);
+		ty2 = std::min(ty2, grid.height - 1);
+
+		const unsigned short* lut1 = &luts[ty1 * row_stride];
+		const unsigned short* lut2 = &luts[ty2 * row_stride];
+		const unsigned char* filled1 = &filled[ty1 * grid.width];
+		const unsigned char* filled2 = &filled[ty2 * grid.width];
+		const T* s = src.ptr<T>(y);
+		T* d = dst.ptr<T>(y);
+		const ucas::uint8* m = mask.data ? mask.ptr<ucas::uint8>(y) : 0;
+		for(int x = 0; x < src.cols; x++)
+		{
+			if(m && !m[x])
+			{
+				d[x] = s[x];
+				continue;
+			}
+			const int a = x1[x], b = x2[x];
+			float w11 = (1.0f - xa[x]) * (1.0f - ya), w12 = xa[x] * (1.0f - ya);
+			float w21 = (1.0f - xa[x]) * ya, w22 = xa[x] * ya;
+
+			// tiles with no pixel of the mask have no weight, the others share it
+			// (the tile of the pixel itself is never empty)
+			if(m && !(filled1[a] && filled1[b] && filled2[a] && filled2[b]))
+			{
+				w11 *= filled1[a];
+				w12 *= filled1[b];
+				w21 *= filled2[a];
+				w22 *= filled2[b];
+				const float w = w11 + w12 + w21 + w22;
+				w11 /= w;
+				w12 /= w;
+				w21 /= w;
+				w22 /= w;
+			}
+
+			// each LUT value weighted by its own bilinear coefficient, summed in the same order as cv::CLAHE
+			const size_t v = s[x];
+			float res = 0;
+			res += lut1[a * bins + v] * w11;
+			res += lut1[b * bins + v] * w12;
+			res += lut2[a * bins + v] * w21;
+			res += lut2[b * bins + v] * w22;
+			d[x] = cv::saturate_cast<T>(res);
+		}
+	}
+}
+
+// equalize 'src' into 'dst' (which may be 'src'), optionally within the 8-bit 'mask'
+void ucas::CLAHE::apply(const cv::Mat & src, cv::Mat & dst, const cv::Mat & mask) throw (ucas::Error)
+{
+	if(!src.data)
+		throw ucas::Error("in CLAHE::apply(): invalid image");
+	if(src.channels() != 1 || (src.depth() != CV_8U && src.depth() != CV_16U))
+		throw ucas::Error("in CLAHE::apply(): only 8- and 16-bit single channel images are supported");
+	if(mask.data && (mask.type() != CV_8UC1 || mask.size() != src.size()))
+		throw ucas::Error("in CLAHE::apply(): the mask must be an 8-bit single channel image of the same size of the input image");
+
+	// keep the input alive: 'dst' may be 'src'
+	const cv::Mat in = src;
+	const bool depth8 = in.depth() == CV_8U;
+
+	// tiles are taken on the image padded by reflection to a multiple of the grid
+	// (both sides are padded whenever either of them is not a multiple, as cv::CLAHE does)
+	cv::Mat image = in, image_mask = mask;
+	if(in.cols % grid.width || in.rows % grid.height)
+	{
+		const int bottom = grid.height - in.rows % grid.height, right = grid.width - in.cols % grid.width;
+		cv::copyMakeBorder(in, padded, 0, bottom, 0, right, cv::BORDER_REFLECT_101);
+		image = padded;
+		if(mask.data)
+		{
+			cv::copyMakeBorder(mask, padded_mask, 0, bottom, 0, right, cv::BORDER_REFLECT_101);
+			image_mask = padded_mask;
+		}
+	}
+	tile_size = cv::Size(image.cols / grid.width, image.rows / grid.height);
+	bins = depth8 ? 256 : 65536;
+	const int n_tiles = grid.area();
+	histograms.resize(size_t(n_tiles) * bins);
+	luts.resize(size_t(n_tiles) * bins);
+	filled.resize(n_tiles);
+
+	// tile LUTs, one task per tile
+	ucas::ThreadPool & pool = ucas::ThreadPool::global();
+	pool.parallel_for(ucas::interval<int>(n_tiles), [&](ucas::interval<int> tiles)
+	{
+		for(int t = tiles.start; t < tiles.end; t++)
+			if(depth8)
+				computeLUT<ucas::uint8>(image, image_mask, t);
+			else
+				computeLUT<ucas::uint16>(image, image_mask, t);
+	}, 1);
+
+	// horizontal interpolation terms are the same on every row
+	x1.resize(in.cols);
+	x2.resize(in.cols);
+	xa.resize(in.cols);
+	for(int x = 0; x < in.cols; x++)
+	{
+		const float txf = static_cast<float>(x) / tile_size.width - 0.5f;
+		const int tx1 = cvFloor(txf);
+		xa[x] = txf - tx1;
+		x1[x] = std::max(tx1, 0);
+		x2[x] = std::min(tx1 + 1, grid.width - 1);
+	}
+
+	// every LUT is complete before the first output pixel is written and each output
+	// pixel only reads the input pixel at its position, so in-place is safe
+	dst.create(in.size(), in.type());
+	auto body = [&](ucas::interval<int> rows)
+	{
+		if(depth8)
+			interpolate<ucas::uint8>(in, dst, mask, rows.start, rows.end);
+		else
+			interpolate<ucas::uint16>(in, dst, mask, rows.start, rows.end);
+	};
+	const int grain = std::max(1, (1 << 16) / in.cols);
+	if(in.rows > grain)
+		pool.parallel_for(ucas::interval<int>(in.rows), body, grain);
+	else
+		body(ucas::interval<int>(in.rows));
+}
@@ -31,12 +31,72 @@ namespace ucas
 	// - 'opencv_flags' are ignored
 	// - pixel values are NOT changed
 	// - 'bits_used' returns the bits used 
+	// - uncompressed images are returned as a copy-on-write view of the memory-mapped file (see dicomMap)
+	// - compressed transfer syntaxes require GDCM (WITH_GDCM)
 	cv::Mat imread(const std::string & path, int opencv_flags = 1, int *bits_used = 0) throw (ucas::Error);
 
 	// rescale the image from 'bits_in' to 'bits_out'
 	void    imrescale(cv::Mat & image, int bits_in, int bits_out) throw (ucas::Error);
 }
 
+/*****************************************************************
+*   Point operations (lookup tables)                             *
+******************************************************************/
+namespace ucas
+{
+	// Table of a point operation, i.e. a function of the intensity only, over
+	// the whole domain of 8- or 16-bit images (256 or 65,536 entries). A table
+	// is compiled once, chained with others into a single table by then(), and
+	// applied in one pass over bands of rows of the global thread pool, so a
+	// chain of point operations costs a single pass over the image.
+	class PointLUT
+	{
+		public:
+
+			// identity from 'depth_in' to 'depth_out' (CV_8U or CV_16U), saturated
+			PointLUT(int depth_in = CV_8U, int depth_out = CV_8U) throw (ucas::Error);
+
+			// table of 'f' (a function of an int returning any arithmetic type) saturated to 'depth_out';
+			// floating point results are rounded to the nearest integer, as by cv::saturate_cast
+			template <class F>
+			static PointLUT compile(int depth_in, int depth_out, F f) throw (ucas::Error)
+			{
+				PointLUT lut(depth_in, depth_out);
+				for(int v = 0; v < int(lut.table.size()); v++)
+					lut.table[v] = depth_out == CV_8U ? cv::saturate_cast<uchar>(f(v)) : cv::saturate_cast<ushort>(f(v));
+				return lut;
+			}
+
+			// this operation followed by 'next', whose input depth must be the output depth of this one
+			PointLUT then(const PointLUT & next) const throw (ucas::Error);
+
+			// dst(x,y) = table[src(x,y)] on every channel; 'src' must have the input depth, 'dst' may be 'src'
+			void apply(const cv::Mat & src, cv::Mat & dst) const throw (ucas::Error);
+
+			int operator()(int v) const { return table[v]; }
+			int depthIn() const { return din; }
+			int depthOut() const { return dout; }
+
+			// same rescaling as imrescale() on images of the given depth
+			static PointLUT rescale(int depth, int bits_in, int bits_out) throw (ucas::Error);
+
+			// 255 on [lo, hi] (0 if 'inverted'), 0 elsewhere, with 8-bit output as binarize()
+			static PointLUT threshold(int depth_in, int lo, int hi, bool inverted = false) throw (ucas::Error);
+
+			// saturate(|alpha * v + beta|), as cv::convertScaleAbs() for 'depth_out' = CV_8U
+			static PointLUT scaleAbs(int depth_in, int depth_out, double alpha, double beta = 0) throw (ucas::Error);
+
+			// linear window of the given center and width (>= 1) stretched to the full output range,
+			// as the DICOM VOI LUT function LINEAR
+			static PointLUT window(int depth_in, int depth_out, double center, double width) throw (ucas::Error);
+
+		private:
+
+			int din, dout;
+			std::vector<unsigned short> table;
+	};
+}
+
 /*****************************************************************
 *   Image binarization methods   								 *
 ******************************************************************/
@@ -90,9 +150,38 @@ namespace ucas
 	// Otsu's threshold algorithm
 	int getOtsuAutoThreshold(const std::vector<int> & data) throw (ucas::Error);
 
+	// thresholds of all the histogram-based binarization methods above
+	struct autoThresholds
+	{
+		int mean, otsu, isodata, triangle, minerror, maxentropy, renyientropy, yen;
+		autoThresholds() : mean(0), otsu(0), isodata(0), triangle(0), minerror(0), maxentropy(0), renyientropy(0), yen(0){}
+
+		// threshold of 'method' ('all' and 'otsuopencv' are not histogram methods)
+		int get(binarizationMethod method) const throw (ucas::Error);
+	};
+
+	// all the thresholds above from a single set of cumulative count, moment and entropy tables
+	// of the histogram, in O(bins) for every method (the single-method functions use the same tables)
+	autoThresholds getAllAutoThresholds(const std::vector<int> & data) throw (ucas::Error);
+
 	// output(x,y) = maxval if input(x,y) > threshold, 0 otherwise
 	// *** WARNING *** : binarization is done in place (8-bit output)
 	cv::Mat binarize(cv::Mat & image, int threshold) throw (ucas::Error);
+
+	// foreground pixels for binarize()
+	enum binarizationMode
+	{
+		binarize_greater,								// input(x,y) >  threshold
+		binarize_greater_equal,							// input(x,y) >= threshold
+		binarize_range									// threshold <= input(x,y) <= threshold_high
+	};
+
+	// output(x,y) = 255 on foreground pixels (background if 'inverted'), 0 otherwise, in a single vectorized pass over
+	// the 8- or 16-bit 'image'; 'dst' may be 'image' itself. If 'packed', 'dst' is a bitmask with (cols+7)/8 bytes
+	// per row instead (pixel x is bit x%8 of byte x/8). If 'histo' is given, it receives the histogram of 'image'
+	// (2^imgdepth bins) computed in the same pass. Returns the number of pixels set in 'dst'.
+	size_t binarize(const cv::Mat & image, cv::Mat & dst, int threshold, binarizationMode mode = binarize_greater, int threshold_high = 0,
+		bool inverted = false, bool packed = false, std::vector<int> * histo = 0) throw (ucas::Error);
 	/*-------------------------------------------------------------------------------------------------------------------------*/
 }
 
@@ -103,9 +192,67 @@ namespace ucas
 {
 	//return image histogram (the number of bins is automatically set to 2^imgdepth if not provided)
 	std::vector<int> histogram(const cv::Mat & image, int bins = -1 ) throw (ucas::Error);
+
+	// scratch counters of histogram(), one set per band of rows: keep it across calls to count several images without allocating
+	struct histogramWorkspace
+	{
+		std::vector< std::vector<int> > bands;
+	};
+
+	// histogram of the 8- or 16-bit 'image' restricted to the nonzero pixels of 'mask' (8-bit, empty = whole image)
+	// - 'hist' is resized to 'bins' (2^imgdepth if -1) reusing its storage, and is added to instead of reset if 'accumulate'
+	//   (histogram of several images)
+	// - if 'parallel', bands of rows are counted on the global thread pool and their partial histograms merged
+	// - the scratch counters are taken from 'workspace' if given, otherwise they are allocated by each call
+	void histogram(const cv::Mat & image, std::vector<int> & hist, int bins = -1, const cv::Mat & mask = cv::Mat(), bool accumulate = false, bool parallel = false,
+		histogramWorkspace * workspace = 0) throw (ucas::Error);
 	
 	// bracket the histogram to the range that holds data
 	std::vector<int> compressHistogram(std::vector<int> &histo, int & minbin);
+
+	// Contrast Limited Adaptive Histogram Equalization of 8- or 16-bit single
+	// channel images, with the tiling, clipping, redistribution and bilinear
+	// interpolation of cv::CLAHE as of OpenCV 2.4, written out in the same
+	// float operations. Tile histograms and LUTs live in a workspace kept across calls,
+	// so equalizing a batch of same-sized images does not allocate after the
+	// first one; tiles are equalized and output rows interpolated on the
+	// global thread pool. With a mask, only the pixels inside it are counted
+	// in the tile histograms and clip limits (e.g. the retina within its FOV),
+	// tiles without any of them get no weight in the interpolation, and the
+	// pixels outside it are left unchanged.
+	class CLAHE
+	{
+		public:
+
+			CLAHE(double clip_limit = 40.0, cv::Size tiles = cv::Size(8, 8)) throw (ucas::Error);
+
+			// equalize 'src' into 'dst' (which may be 'src'), optionally within the 8-bit 'mask'
+			void apply(const cv::Mat & src, cv::Mat & dst, const cv::Mat & mask = cv::Mat()) throw (ucas::Error);
+
+			double clipLimit() const { return clip; }
+			cv::Size tiles() const { return grid; }
+
+		private:
+
+			// histogram, clipping and cumulative LUT of tile 'tile' of the (padded) image
+			template <typename T>
+			void computeLUT(const cv::Mat & image, const cv::Mat & mask, int tile);
+
+			// output rows [y0, y1) interpolated between the LUTs of the 4 nearest tiles
+			template <typename T>
+			void interpolate(const cv::Mat & src, cv::Mat & dst, const cv::Mat & mask, int y0, int y1) const;
+
+			double clip;
+			cv::Size grid;
+			cv::Size tile_size;					// tile size on the padded image
+			int bins;							// 256 or 65536
+			cv::Mat padded, padded_mask;		// input (and mask) padded to a multiple of the grid, if needed
+			std::vector<int> histograms;		// one per tile
+			std::vector<unsigned short> luts;	// one per tile, row-major over the grid
+			std::vector<unsigned char> filled;	// per tile, whether it holds pixels of the mask
+			std::vector<int> x1, x2;			// per column, left and right nearest tiles
+			std::vector<float> xa;				// per column, horizontal distance from the left tile center
+	};
 }
 
 #endif
\ No newline at end of file
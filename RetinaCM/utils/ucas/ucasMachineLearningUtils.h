@@ -2,17 +2,41 @@
 #define _UCAS_MACHINE_LEARNING_UTILS_H
 
 #include <string>
+#include <cmath>
 #include <fstream>
 #include <functional>
 #include <algorithm>
+#include <atomic>
 #include "ucasLog.h"
+#include "ucasExceptions.h"
+#include "ucasMathUtils.h"
+#include "ucasMultithreading.h"
 
 namespace ucas
 {
 	struct classification_outcome
 	{
-		int TP, FN, FP;
-		classification_outcome() : TP(0), FN(0), FP(0){};
+		unsigned long long TP, FN, FP, TN;
+		classification_outcome() : TP(0), FN(0), FP(0), TN(0){};
+
+		classification_outcome & operator+=(const classification_outcome & o){
+			TP += o.TP; FN += o.FN; FP += o.FP; TN += o.TN;
+			return *this;
+		}
+
+		// derived metrics (0 when undefined)
+		double sensitivity() const { return ratio(TP, TP + FN); }
+		double specificity() const { return ratio(TN, TN + FP); }
+		double precision() const { return ratio(TP, TP + FP); }
+		double accuracy() const { return ratio(TP + TN, TP + TN + FP + FN); }
+		double dice() const { return ratio(2*TP, 2*TP + FP + FN); }
+		double mcc() const {
+			const double d = std::sqrt(double(TP + FP)) * std::sqrt(double(TP + FN)) * std::sqrt(double(TN + FP)) * std::sqrt(double(TN + FN));
+			return d > 0 ? (double(TP)*TN - double(FP)*FN) / d : 0.0;
+		}
+
+		private:
+			static double ratio(unsigned long long num, unsigned long long den){ return den ? double(num) / den : 0.0; }
 	};
 
 	struct ROC_point
@@ -50,33 +74,71 @@ namespace ucas
 				return tpr == r.tpr && fpr == r.fpr;
 			}
 			bool operator!=(const ROCpoint<T> & r){
-				return !(this == r);
+				return !(*this == r);
 			}
 		};
 
-		// ROC worker for multithreading
+		// strict ordering of scores from the most to the least likely positive
+		template <typename T>
+		struct score_order
+		{
+			bool greater;
+			score_order(bool _greater) : greater(_greater){}
+			bool operator()(T a, T b) const { return greater ? a > b : a < b; }
+		};
+
+		// ROC points at every distinct score (plus +inf and -inf), in one pass over the sorted scores
+		// *** WARNING *** : 'pos' and 'neg' are sorted in place and must not contain nan scores
+		// consecutive points with the same (TPR,FPR) are merged into the first one
 		template <typename T>
-		inline void
-			ROC_worker(
-			std::vector<T> &pos,					// positive sample score array
-			std::vector<T> &neg,					// negative sample score array
-			std::vector< ROCpoint<T> > &curve,		// preallocated ROC curve
-			std::vector<T> &thresholds,				// precomputed set of thresholds
-			size_t t0, size_t t1,					// range [t0, t1) of ROC points to calculate
-			bool pos_greater_than_neg)				// 1 = the higher the sample score, the higher the probability of being positive
+		inline
+			std::vector< ROCpoint<T> >		// return a sequence of ROC points
+			ROC_sweep(
+			std::vector<T> &pos,			// positive sample score array
+			std::vector<T> &neg,			// negative sample score array
+			bool pos_greater_than_neg,		// 1 = the higher the sample score, the higher the probability of being positive
 			// 0 = the lower  the sample score, the higher the probability of being positive
+			bool parallel = false)			// sort on the global thread pool
 		{
-			for(size_t k=t0; k<t1; k++)
+			// sort scores from the most to the least likely positive
+			score_order<T> before(pos_greater_than_neg);
+			if(parallel)
 			{
-				int TPs=0, FPs=0;
-				for(int i=0; i<pos.size(); i++)
-					TPs += static_cast<int>(pos_greater_than_neg ? pos[i] >= thresholds[k] : pos[i] <= thresholds[k]);
-				for(int i=0; i<neg.size(); i++)
-					FPs += static_cast<int>(pos_greater_than_neg ? neg[i] >= thresholds[k] : neg[i] <= thresholds[k]);
-				curve[k].tpr = static_cast<T>(TPs) / pos.size();
-				curve[k].fpr = static_cast<T>(FPs) / neg.size();
-				curve[k].t = thresholds[k];
+				ucas::parallel_sort(pos.begin(), pos.end(), before);
+				ucas::parallel_sort(neg.begin(), neg.end(), before);
 			}
+			else
+			{
+				std::sort(pos.begin(), pos.end(), before);
+				std::sort(neg.begin(), neg.end(), before);
+			}
+
+			// sweep the distinct thresholds in the same order: the samples at or above each one are a prefix of either array
+			const T first = pos_greater_than_neg ? std::numeric_limits<T>::infinity() : -std::numeric_limits<T>::infinity();
+			std::vector< ROCpoint<T> > out;
+			size_t TPs = 0, FPs = 0;
+			T t = first;
+			for(;;)
+			{
+				while(TPs < pos.size() && !before(t, pos[TPs]))
+					TPs++;
+				while(FPs < neg.size() && !before(t, neg[FPs]))
+					FPs++;
+				ROCpoint<T> point(static_cast<T>(TPs) / pos.size(), static_cast<T>(FPs) / neg.size(), t);
+				if(out.empty() || !(out.back() == point))
+					out.push_back(point);
+
+				// next threshold: the next score, or the opposite infinity once all samples are counted
+				if(TPs < pos.size() && (FPs == neg.size() || !before(neg[FPs], pos[TPs])))
+					t = pos[TPs];
+				else if(FPs < neg.size())
+					t = neg[FPs];
+				else if(t != -first)
+					t = -first;
+				else
+					break;
+			}
+			return out;
 		}
 
 		// calculate ROC curve from positive and negative sample score arrays (multi-threaded version)
@@ -100,50 +162,10 @@ namespace ucas
 			pos.erase(std::remove_if(pos.begin(), pos.end(), is_nan), pos.end());
 			neg.erase(std::remove_if(neg.begin(), neg.end(), is_nan), neg.end());
 
-			// generate unique, left-to-right ROC points from distinct scores (also adding +inf and -inf corresponding to ROC extremes (0,0) and (1,1))
-			std::vector<T> thresholds;
-			for(int i=0; i<pos.size(); i++)
-				thresholds.push_back(pos[i]);
-			for(int i=0; i<neg.size(); i++)
-				thresholds.push_back(neg[i]);
-			thresholds.push_back(std::numeric_limits<T>::infinity());
-			thresholds.push_back(-std::numeric_limits<T>::infinity());
-			if(pos_greater_than_neg)
-				std::sort(thresholds.begin(), thresholds.end(), std::greater<T>());	
-			else
-				std::sort(thresholds.begin(), thresholds.end(), std::less<T>());	
-			thresholds.erase(unique(thresholds.begin(), thresholds.end()), thresholds.end());
-
-			// compute ROC	
-			std::vector< ROCpoint<T> > out(thresholds.size());
-			if(ucas::MULTITHREADED_TESTING)
-			{
-				int n_threads = ucas::THREADS_CONCURRENCY;
-				std::vector <std::thread*> threads;
-				size_t n_thresholds_i = thresholds.size()/n_threads;
-				size_t t_count = 0;
-				for(int t=0; t<n_threads; t++)
-				{
-					std::thread *thr = new std::thread(ucas::ml::ROC_worker<T>, std::ref(pos), std::ref(neg), std::ref(out), std::ref(thresholds), t_count, t_count + (t<thresholds.size()%n_threads ? n_thresholds_i+1 : n_thresholds_i), pos_greater_than_neg );
-					if(!thr)
-						throw ucas::Error(ucas::strprintf("Failed to allocated thread %d/%d)", t+1, n_threads));
-					threads.push_back(thr);
-					t_count += (t<thresholds.size()%n_threads ? n_thresholds_i+1 : n_thresholds_i);
-				}
-
-				// run and join
-				for(int t=0; t<n_threads; t++)
-					threads[t]->join();
-
-				// release memory
-				for(int t=0; t<n_threads; t++)
-					delete threads[t];
-			}
-			else
-				ROC_worker<T>(pos, neg, out, thresholds, 0, thresholds.size(), pos_greater_than_neg);
-
-			// remove duplicates
-			out.erase(unique(out.begin(), out.end()), out.end());
+			// compute ROC (unique, left-to-right ROC points from distinct scores, plus +inf and -inf corresponding to ROC extremes (0,0) and (1,1))
+			// on sorted copies, so that the caller's scores keep their order
+			std::vector<T> sorted_pos(pos), sorted_neg(neg);
+			std::vector< ROCpoint<T> > out = ROC_sweep(sorted_pos, sorted_neg, pos_greater_than_neg, true);
 
 			// push (0,0) if needed
 			if(out.front().tpr != 0 || out.front().fpr != 0)
@@ -179,35 +201,13 @@ namespace ucas
 			//pos.erase(std::remove_if(pos.begin(), pos.end(), std::not1(std::ptr_fun(mcd::isfinite<T>))), pos.end());
 			//neg.erase(std::remove_if(neg.begin(), neg.end(), std::not1(std::ptr_fun(mcd::isfinite<T>))), neg.end());
 
-			// generate unique, left-to-right ROC points from distinct scores (also adding +inf and -inf corresponding to ROC extremes (0,0) and (1,1))
-			std::vector<T> thresholds;
-			for(int i=0; i<pos.size(); i++)
-				thresholds.push_back(pos[i]);
-			for(int i=0; i<neg.size(); i++)
-				thresholds.push_back(neg[i]);
-			thresholds.push_back(std::numeric_limits<T>::infinity());
-			thresholds.push_back(-std::numeric_limits<T>::infinity());
-			if(pos_greater_than_neg)
-				std::sort(thresholds.begin(), thresholds.end(), std::greater<T>());	
-			else
-				std::sort(thresholds.begin(), thresholds.end(), std::less<T>());	
-			thresholds.erase(unique(thresholds.begin(), thresholds.end()), thresholds.end());
-
-			// compute ROC	
+			// compute ROC (unique, left-to-right ROC points from distinct scores, plus +inf and -inf corresponding to ROC extremes (0,0) and (1,1))
+			// on sorted copies, so that the caller's scores keep their order
+			std::vector<T> sorted_pos(pos), sorted_neg(neg);
+			std::vector< ROCpoint<T> > curve = ROC_sweep(sorted_pos, sorted_neg, pos_greater_than_neg);
 			std::vector<std::pair<T, T>> out;
-			for(int k=0; k<thresholds.size(); k++)
-			{
-				int TPs=0, FPs=0;
-				for(int i=0; i<pos.size(); i++)
-					TPs += static_cast<int>(pos_greater_than_neg ? pos[i] >= thresholds[k] : pos[i] <= thresholds[k]);
-				for(int i=0; i<neg.size(); i++)
-					FPs += static_cast<int>(pos_greater_than_neg ? neg[i] >= thresholds[k] : neg[i] <= thresholds[k]);
-				out.push_back(std::pair<T,T>(static_cast<T>(TPs) / pos.size(), static_cast<T>(FPs) / neg.size()));
-			}
-
-			// remove duplicates
-			out.erase(unique(out.begin(), out.end()), out.end());
-
+			for(size_t k=0; k<curve.size(); k++)
+				out.push_back(std::pair<T,T>(curve[k].tpr, curve[k].fpr));
 
 			// push (0,0) if needed
 			if(out.front().first != T(0) || out.front().second != T(0))
@@ -280,18 +280,106 @@ namespace ucas
 		}
 
 
+		// Mann-Whitney placements of the 'a' scores among the 'b' scores, both sorted by 'before' (see ROC_sweep)
+		// returns the sum over 'a' of (#b strictly after + 0.5 #b tied), optionally storing each term / b.size() in 'placements'
+		template <typename T>
+		inline
+			double
+			WMW_placements(
+			const std::vector<T> &a,				// sorted scores whose placements are calculated
+			const std::vector<T> &b,				// sorted reference scores
+			score_order<T> before,					// sort order of both arrays
+			std::vector<double> *placements = 0)	// optional per-sample placements
+		{
+			if(placements)
+				placements->resize(a.size());
+			std::atomic<unsigned long long> U2(0);	// twice the U statistic, to keep ties exact
+
+			ucas::ThreadPool::global().parallel_for(interval<int>(int(a.size())), [&](interval<int> r)
+			{
+				// b[0, ahead) come strictly before a[k], b[ahead, upto) are tied with it
+				size_t ahead = std::lower_bound(b.begin(), b.end(), a[r.start], before) - b.begin();
+				size_t upto  = std::upper_bound(b.begin() + ahead, b.end(), a[r.start], before) - b.begin();
+				unsigned long long sum = 0;
+				for(int k = r.start; k < r.end; k++)
+				{
+					while(ahead < b.size() && before(b[ahead], a[k]))
+						ahead++;
+					if(upto < ahead)
+						upto = ahead;
+					while(upto < b.size() && !before(a[k], b[upto]))
+						upto++;
+					const unsigned long long twice = 2*(b.size() - upto) + (upto - ahead);
+					sum += twice;
+					if(placements)
+						(*placements)[k] = 0.5*twice / b.size();
+				}
+				U2 += sum;
+			});
+			return 0.5*U2;
+		}
+
+		// sample variance of 'x'
+		inline double sample_variance(const std::vector<double> &x)
+		{
+			if(x.size() < 2)
+				return 0;
+			double mean = 0, var = 0;
+			for(size_t i=0; i<x.size(); i++)
+				mean += x[i];
+			mean /= x.size();
+			for(size_t i=0; i<x.size(); i++)
+				var += (x[i]-mean)*(x[i]-mean);
+			return var / (x.size()-1);
+		}
+
 		// calculate AUC with Wilcoxon-Mann-Whitney from positive and negative sample score arrays
+		// the U statistic is obtained from the ranks of the sorted scores (ties count 1/2, i.e. midranks), in O((P+N)log(P+N))
+		// nan scores are erased from 'pos' and 'neg', the other scores are sorted on copies and keep their order
 		template <typename T>
 		inline 
 			T									// return AUC
 			AUC_wmw(
 			std::vector<T> &pos,			// positive sample scores array
 			std::vector<T> &neg,			// negative sample scores array
+			bool pos_greater_than_neg = 1,	// 1 = the higher the sample score, the higher the probability of being positive
+			// 0 = the lower  the sample score, the higher the probability of being positive
+			double *variance = 0)			// if not null, DeLong's estimate of the AUC variance
+		{
+			// discard nonfinite scores
+			pos.erase(std::remove_if(pos.begin(), pos.end(), is_nan), pos.end());
+			neg.erase(std::remove_if(neg.begin(), neg.end(), is_nan), neg.end());
+
+			score_order<T> before(pos_greater_than_neg);
+			std::vector<T> sorted_pos(pos), sorted_neg(neg);
+			ucas::parallel_sort(sorted_pos.begin(), sorted_pos.end(), before);
+			ucas::parallel_sort(sorted_neg.begin(), sorted_neg.end(), before);
+
+			// apply WMW rule
+			std::vector<double> V10, V01;
+			double res = WMW_placements(sorted_pos, sorted_neg, before, variance ? &V10 : 0);
+			if(variance)
+			{
+				// DeLong et al. (1988): structural components of positives and negatives
+				// (the placements of the negatives among the positives are 1 - V01, which has the same variance)
+				WMW_placements(sorted_neg, sorted_pos, before, &V01);
+				*variance = sample_variance(V10)/pos.size() + sample_variance(V01)/neg.size();
+			}
+			return res/(static_cast<T>(pos.size())*static_cast<T>(neg.size()));
+		}
+
+		// calculate AUC with Wilcoxon-Mann-Whitney from positive and negative sample score arrays by comparing all (pos, neg) pairs
+		// reference implementation of AUC_wmw, O(P*N)
+		template <typename T>
+		inline 
+			T									// return AUC
+			AUC_wmw_pairwise(
+			std::vector<T> &pos,			// positive sample scores array
+			std::vector<T> &neg,			// negative sample scores array
 			bool pos_greater_than_neg = 1)	// 1 = the higher the sample score, the higher the probability of being positive
 			// 0 = the lower  the sample score, the higher the probability of being positive
 		{
 			// discard nonfinite scores
-			int nPos = int(pos.size()), nNeg = int(neg.size());	// store #pos, #neg before we erase samples
 			pos.erase(std::remove_if(pos.begin(), pos.end(), is_nan), pos.end());
 			neg.erase(std::remove_if(neg.begin(), neg.end(), is_nan), neg.end());
 
@@ -318,6 +406,160 @@ namespace ucas
 			return res/(static_cast<T>(pos.size())*static_cast<T>(neg.size()));
 		}
 
+		// Streaming ROC accumulator over fixed-width score bins. Scores of either
+		// class are only counted in their bin, so memory does not depend on the
+		// number of samples, and accumulators filled by different threads or
+		// images with the same binning can be merged. Curve and AUC are those of
+		// the binned scores: scores sharing a bin are tied, which bounds the AUC
+		// error by AUC_error(). With integer scores and one bin per value (e.g.
+		// 8-bit maps with lo = 0, hi = 256, bins = 256) they are exact.
+		// Adaptive binning is not supported.
+		class ROC_histogram
+		{
+			public:
+
+				ROC_histogram(
+					double _lo = 0, double _hi = 1,		// score range [lo, hi): scores outside it (including infinities) go to the first / last bin
+					int _bins = 256,					// number of bins
+					bool _pos_greater_than_neg = 1)		// 1 = the higher the sample score, the higher the probability of being positive
+					throw (ucas::Error)
+					: lo(_lo), hi(_hi), pos_greater_than_neg(_pos_greater_than_neg), pos(_bins, 0), neg(_bins, 0), nPos(0), nNeg(0)
+				{
+					if(_bins < 1)
+						throw ucas::Error(ucas::strprintf("in ROC_histogram(): invalid number of bins %d", _bins));
+					if(!(hi > lo))
+						throw ucas::Error(ucas::strprintf("in ROC_histogram(): invalid score range [%g, %g)", lo, hi));
+					scale = _bins / (hi - lo);
+				}
+
+				int bins() const { return int(pos.size()); }
+				unsigned long long positives() const { return nPos; }
+				unsigned long long negatives() const { return nNeg; }
+
+				// bin of 'score' (not nan)
+				int bin(double score) const
+				{
+					const double b = (score - lo) * scale;
+					return b <= 0 ? 0 : b >= pos.size() ? bins() - 1 : int(b);
+				}
+
+				// count 'n' scores of the given class, skipping nan scores
+				template <typename T>
+				void add(const T *scores, size_t n, bool positive)
+				{
+					std::vector<unsigned long long> &h = positive ? pos : neg;
+					unsigned long long count = 0;
+					for(size_t i=0; i<n; i++)
+						if(scores[i] == scores[i])
+						{
+							h[bin(double(scores[i]))]++;
+							count++;
+						}
+					(positive ? nPos : nNeg) += count;
+				}
+				void add(double score, bool positive)
+				{
+					add(&score, 1, positive);
+				}
+
+				// count 'n' scores whose class is given per sample ('positive[i]' != 0), skipping nan scores
+				// and, if 'selected' is not null, the samples with 'selected[i]' == 0 (e.g. pixels outside a mask)
+				template <typename T>
+				void add(const T *scores, const unsigned char *positive, const unsigned char *selected, size_t n)
+				{
+					unsigned long long countPos = 0, countNeg = 0;
+					for(size_t i=0; i<n; i++)
+						if((!selected || selected[i]) && scores[i] == scores[i])
+						{
+							const int b = bin(double(scores[i]));
+							if(positive[i])
+							{
+								pos[b]++;
+								countPos++;
+							}
+							else
+							{
+								neg[b]++;
+								countNeg++;
+							}
+						}
+					nPos += countPos;
+					nNeg += countNeg;
+				}
+
+				// add the counts of an accumulator with the same binning
+				void merge(const ROC_histogram &h) throw (ucas::Error)
+				{
+					if(h.lo != lo || h.hi != hi || h.bins() != bins() || h.pos_greater_than_neg != pos_greater_than_neg)
+						throw ucas::Error("in ROC_histogram::merge(): different binning");
+					for(size_t b=0; b<pos.size(); b++)
+					{
+						pos[b] += h.pos[b];
+						neg[b] += h.neg[b];
+					}
+					nPos += h.nPos;
+					nNeg += h.nNeg;
+				}
+
+				// ROC points from (0,0) to (1,1), with thresholds at the bin edges (the first one is infinite)
+				std::vector< ROCpoint<double> > curve() const throw (ucas::Error)
+				{
+					check("curve");
+					std::vector< ROCpoint<double> > out;
+					out.push_back(ROCpoint<double>(0, 0, pos_greater_than_neg ? std::numeric_limits<double>::infinity() : -std::numeric_limits<double>::infinity()));
+					unsigned long long TPs = 0, FPs = 0;
+					for(int k=0; k<bins(); k++)
+					{
+						const int b = pos_greater_than_neg ? bins()-1-k : k;
+						TPs += pos[b];
+						FPs += neg[b];
+						ROCpoint<double> point(double(TPs) / nPos, double(FPs) / nNeg, lo + (pos_greater_than_neg ? b : b+1) / scale);
+						if(!(out.back() == point))
+							out.push_back(point);
+					}
+					return out;
+				}
+
+				// area under curve(), i.e. WMW statistic of the binned scores
+				double AUC() const throw (ucas::Error)
+				{
+					check("AUC");
+					double U = 0, TPs = 0;
+					for(int k=0; k<bins(); k++)
+					{
+						const int b = pos_greater_than_neg ? bins()-1-k : k;
+						U += neg[b] * (TPs + 0.5*pos[b]);
+						TPs += pos[b];
+					}
+					return U / (double(nPos) * double(nNeg));
+				}
+
+				// maximum difference between AUC() and the AUC of the unbinned scores (pairs sharing a bin count 1/2 instead of 0 or 1)
+				double AUC_error() const throw (ucas::Error)
+				{
+					check("AUC_error");
+					double tied = 0;
+					for(size_t b=0; b<pos.size(); b++)
+						tied += double(pos[b]) * neg[b];
+					return 0.5 * tied / (double(nPos) * double(nNeg));
+				}
+
+			private:
+
+				void check(const char *func) const throw (ucas::Error)
+				{
+					if(!nPos)
+						throw ucas::Error(ucas::strprintf("in ROC_histogram::%s(): no positive samples found", func));
+					if(!nNeg)
+						throw ucas::Error(ucas::strprintf("in ROC_histogram::%s(): no negative samples found", func));
+				}
+
+				double lo, hi, scale;
+				bool pos_greater_than_neg;
+				std::vector<unsigned long long> pos, neg;	// per-bin counts
+				unsigned long long nPos, nNeg;
+		};
+
 		template <typename T>
 		inline 
 			void 
@@ -378,7 +620,7 @@ namespace ucas
 		{
 			for(int k=1; k<=iterations; k++)
 			{
-				double t0 = -TIME(0);
+				ucas::Timer timer;
 				printf("auc_tests iteration %03d/%03d...", k, iterations);
 
 				int nPos = 10000, nNeg = 10000;
@@ -451,7 +693,24 @@ namespace ucas
 					throw ucas::Error(ucas::strprintf("test #4 failed: val4c != 0 (%g)", val4a));
 				if(val4d != 0)
 					throw ucas::Error(ucas::strprintf("test #4 failed: val4d != 0 (%g)", val4b));
-				printf("DONE in %.4f s\n", t0 + TIME(0));
+
+
+				// test #5: rank-based AUC_wmw must match the pairwise count exactly, also with many ties
+				pos.clear();
+				neg.clear();
+				int levels = rand()%20+1;
+				for(int i=0; i<nPos; i++)
+					pos.push_back( static_cast<double>(rand()%levels) );
+				for(int i=0; i<nNeg; i++)
+					neg.push_back( static_cast<double>(rand()%levels) );
+				for(int dir=0; dir<2; dir++)
+				{
+					double val5a = ucas::ml::AUC_wmw(pos, neg, dir != 0);
+					double val5b = ucas::ml::AUC_wmw_pairwise(pos, neg, dir != 0);
+					if(val5a != val5b)
+						throw ucas::Error(ucas::strprintf("test #5 failed: AUC_wmw != AUC_wmw_pairwise (%g != %g)", val5a, val5b));
+				}
+				printf("DONE in %.4f s\n", timer.elapsed<double>());
 			}
 		}
 	}
@@ -1,6 +1,215 @@
 #include "ucasMultithreading.h"
+#include <algorithm>
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define UCAS_THREAD_LOCAL __declspec(thread)
+#else
+#define UCAS_THREAD_LOCAL thread_local
+#endif
 
 namespace ucas
 {
 	int THREADS_CONCURRENCY = std::thread::hardware_concurrency();			//number of concurrent threads when multithread mode is enabled
-}
\ No newline at end of file
+}
+
+namespace
+{
+	// pool and deque of the calling thread, if it is a pool worker
+	UCAS_THREAD_LOCAL const ucas::ThreadPool * current_pool = 0;
+	UCAS_THREAD_LOCAL int current_queue = -1;
+}
+
+ucas::ThreadPool::ThreadPool(int n_threads) : queued(0), waiters(0), stop(false)
+{
+	n_threads = std::max(1, n_threads);
+	for(int i = 0; i <= n_threads; i++)
+		queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+	for(int i = 0; i < n_threads; i++)
+		workers.push_back(std::thread(&ThreadPool::loop, this, i));
+}
+
+ucas::ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lk(sleep_lock);
+		stop = true;
+	}
+	wake.notify_all();
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+ucas::ThreadPool & ucas::ThreadPool::global()
+{
+	// never destroyed: workers may still be sleeping when static destructors run
+	static std::once_flag created;
+	static ThreadPool * pool = 0;
+	std::call_once(created, [](){ pool = new ThreadPool(std::max(1, THREADS_CONCURRENCY - 1)); });
+	return *pool;
+}
+
+void ucas::ThreadPool::push(std::function<void()> task)
+{
+	TaskQueue & q = *queues[current_pool == this ? current_queue : queues.size() - 1];
+	{
+		std::unique_lock<std::mutex> lk(q.lock);
+		q.tasks.push_back(std::move(task));
+	}
+	queued++;
+	bool waiting;
+	{
+		// pairs with the predicate checks in loop() and wait(), so the notification cannot be lost
+		std::unique_lock<std::mutex> lk(sleep_lock);
+		waiting = waiters > 0;
+	}
+	wake.notify_one();
+	if(waiting)
+		finished.notify_all();
+}
+
+void ucas::ThreadPool::signal()
+{
+	{
+		// pairs with the predicate check in wait(), as in push()
+		std::unique_lock<std::mutex> lk(sleep_lock);
+		if(!waiters)
+			return;
+	}
+	finished.notify_all();
+}
+
+void ucas::ThreadPool::wait(const std::function<bool()> & ready, bool help)
+{
+	while(!ready())
+	{
+		if(help && runPending())
+			continue;
+
+		std::unique_lock<std::mutex> lk(sleep_lock);
+		waiters++;
+		finished.wait(lk, [this, &ready, help]{ return (help && queued > 0) || ready(); });
+		waiters--;
+	}
+}
+
+bool ucas::ThreadPool::pop(std::function<void()> & task)
+{
+	if(queued <= 0)
+		return false;
+
+	// own deque first (newest task), then steal the oldest task of the others
+	const int self = current_pool == this ? current_queue : int(queues.size()) - 1;
+	{
+		TaskQueue & q = *queues[self];
+		std::unique_lock<std::mutex> lk(q.lock);
+		if(!q.tasks.empty())
+		{
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+	for(size_t k = 1; k < queues.size(); k++)
+	{
+		TaskQueue & q = *queues[(self + k) % queues.size()];
+		std::unique_lock<std::mutex> lk(q.lock);
+		if(!q.tasks.empty())
+		{
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ucas::ThreadPool::runPending()
+{
+	std::function<void()> task;
+	if(!pop(task))
+		return false;
+	task();
+	return true;
+}
+
+void ucas::ThreadPool::loop(int index)
+{
+	current_pool = this;
+	current_queue = index;
+	for(;;)
+	{
+		if(runPending())
+			continue;
+
+		std::unique_lock<std::mutex> lk(sleep_lock);
+		wake.wait(lk, [this]{ return stop || queued > 0; });
+		if(stop)
+			return;
+	}
+}
+
+void ucas::ThreadPool::parallel_for(interval<int> range, const std::function<void(interval<int>)> & body, int grain)
+{
+	const int n = range.end - range.start;
+	if(n <= 0)
+		return;
+	if(grain <= 0)
+		grain = std::max(1, n / (4 * (size() + 1)));
+	const int chunks = (n + grain - 1) / grain;
+	if(chunks == 1)
+	{
+		body(range);
+		return;
+	}
+
+	// shared with the helper tasks, which may only get to run after all the chunks are done
+	struct State
+	{
+		std::function<void(interval<int>)> body;
+		interval<int> range;
+		int grain, chunks;
+		std::atomic<int> next, done;
+		std::mutex error_lock;
+		std::exception_ptr error;
+	};
+	std::shared_ptr<State> state = std::make_shared<State>();
+	state->body = body;
+	state->range = range;
+	state->grain = grain;
+	state->chunks = chunks;
+	state->next = 0;
+	state->done = 0;
+
+	std::function<void()> run = [this, state]()
+	{
+		for(int c = state->next++; c < state->chunks; c = state->next++)
+		{
+			const int start = state->range.start + c * state->grain;
+			try
+			{
+				state->body(interval<int>(start, std::min(start + state->grain, state->range.end)));
+			}
+			catch(...)
+			{
+				std::unique_lock<std::mutex> lk(state->error_lock);
+				if(!state->error)
+					state->error = std::current_exception();
+			}
+			if(++state->done == state->chunks)
+				signal();
+		}
+	};
+	const int helpers = std::min(chunks - 1, size());
+	for(int i = 0; i < helpers; i++)
+		push(run);
+	run();
+
+	// every chunk is claimed: sleep until those running elsewhere are done, without picking up
+	// queued tasks, which may be unrelated (and long) work such as other iterations of an outer loop
+	wait([&state, chunks](){ return state->done >= chunks; }, false);
+
+	if(state->error)
+		std::rethrow_exception(state->error);
+}
@@ -4,10 +4,132 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include "ucasMathUtils.h"
 
 namespace ucas
 {
 	extern int THREADS_CONCURRENCY;				//number of concurrent threads when multithread mode is enabled
+
+	// Persistent work-stealing thread pool. Every worker has its own task deque:
+	// tasks submitted from a worker go to the back of its deque and are taken
+	// back LIFO, idle workers steal from the front of the others' deques, and
+	// tasks submitted from outside the pool go to a shared deque. Waiting on a
+	// result through get() runs pending tasks meanwhile, so it can be called
+	// from inside tasks (nested parallelism) without deadlocking or spawning
+	// extra threads. parallel_for() runs chunks of its own loop only: once all
+	// of them are claimed, the caller sleeps until the other threads are done
+	// with theirs, so a nested loop never picks up unrelated work (e.g. other
+	// iterations of an outer loop) and returns as soon as its own chunks do.
+	class ThreadPool
+	{
+		public:
+
+			// 'n_threads' workers; the thread waiting for results works too
+			ThreadPool(int n_threads = THREADS_CONCURRENCY - 1);
+			~ThreadPool();
+
+			int size() const { return int(workers.size()); }
+
+			// queue 'f' for execution and return its future
+			template <class F>
+			std::future<typename std::result_of<F()>::type> submit(F f)
+			{
+				typedef typename std::result_of<F()>::type R;
+				std::shared_ptr< std::packaged_task<R()> > task = std::make_shared< std::packaged_task<R()> >(f);
+				std::future<R> result = task->get_future();
+				push([this, task](){ (*task)(); signal(); });
+				return result;
+			}
+
+			// wait for 'f', running queued tasks in the meantime
+			template <class R>
+			R get(std::future<R> & f)
+			{
+				wait([&f](){ return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready; });
+				return f.get();
+			}
+
+			// call 'body' on consecutive chunks of at most 'grain' elements (0 = automatic) covering 'range' and wait for all of them
+			// the first exception thrown by 'body' is rethrown here once every chunk is done
+			void parallel_for(interval<int> range, const std::function<void(interval<int>)> & body, int grain = 0);
+
+			// run one queued task on the calling thread, if any
+			bool runPending();
+
+			// process-wide pool sized by THREADS_CONCURRENCY, created on first use
+			static ThreadPool & global();
+
+		private:
+
+			struct TaskQueue
+			{
+				std::mutex lock;
+				std::deque< std::function<void()> > tasks;
+			};
+
+			void push(std::function<void()> task);
+			bool pop(std::function<void()> & task);
+			void loop(int index);
+
+			// run queued tasks (if 'help') until 'ready' holds, sleeping while there is nothing to run
+			void wait(const std::function<bool()> & ready, bool help = true);
+
+			// wake the threads sleeping in wait(), once something they may be waiting for is done
+			void signal();
+
+			std::vector< std::unique_ptr<TaskQueue> > queues;	// one per worker, the last one for external threads
+			std::vector<std::thread> workers;
+			std::atomic<int> queued;							// tasks in all the deques
+			std::mutex sleep_lock;
+			std::condition_variable wake;						// workers sleep here
+			std::condition_variable finished;					// waiters sleep here
+			int waiters;										// threads sleeping in wait(), guarded by 'sleep_lock'
+			bool stop;
+
+			ThreadPool(const ThreadPool &);
+			ThreadPool & operator=(const ThreadPool &);
+	};
+
+	// sort [first, last) on the global pool: chunks are sorted concurrently, then merged pairwise level by level
+	template <class It, class Compare>
+	void parallel_sort(It first, It last, Compare comp, int min_chunk = 1 << 15)
+	{
+		const int n = int(last - first);
+		const int n_chunks = std::min(ThreadPool::global().size() + 1, std::max(1, n / std::max(1, min_chunk)));
+		if(n_chunks < 2)
+		{
+			std::sort(first, last, comp);
+			return;
+		}
+
+		std::vector< interval<int> > chunks = partition(interval<int>(n), n_chunks);
+		ThreadPool::global().parallel_for(interval<int>(n_chunks), [&](interval<int> r)
+		{
+			for(int c = r.start; c < r.end; c++)
+				std::sort(first + chunks[c].start, first + chunks[c].end, comp);
+		}, 1);
+		for(int width = 1; width < n_chunks; width *= 2)
+		{
+			const int n_pairs = (n_chunks + 2*width - 1) / (2*width);
+			ThreadPool::global().parallel_for(interval<int>(n_pairs), [&](interval<int> r)
+			{
+				for(int p = r.start; p < r.end; p++)
+				{
+					const int a = 2*width*p, b = std::min(a + width, n_chunks), c = std::min(a + 2*width, n_chunks);
+					if(b < c)
+						std::inplace_merge(first + chunks[a].start, first + chunks[b].start, first + chunks[c-1].end, comp);
+				}
+			}, 1);
+		}
+	}
 }
 
-#endif
\ No newline at end of file
+#endif
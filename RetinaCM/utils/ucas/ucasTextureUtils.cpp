@@ -0,0 +1,204 @@
+#include "ucasTextureUtils.h"
+#include "ucasStringUtils.h"
+#include "ucasMultithreading.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	inline double plogp(double p)
+	{
+		return p > 0 ? p*std::log(p) : 0.0;
+	}
+}
+
+std::vector<cv::Point> ucas::GLCM::defaultOffsets()
+{
+	std::vector<cv::Point> offsets;
+	offsets.push_back(cv::Point(1, 0));
+	offsets.push_back(cv::Point(1, -1));
+	offsets.push_back(cv::Point(0, -1));
+	offsets.push_back(cv::Point(-1, -1));
+	return offsets;
+}
+
+ucas::GLCM::GLCM(const std::vector<cv::Point> & _offsets, int _levels) throw (ucas::Error)
+	: offsets(_offsets), nlevels(_levels), lut_depth(-1)
+{
+	if(offsets.empty())
+		throw ucas::Error("in GLCM(): no offsets given");
+	if(nlevels < 2 || nlevels > 1024)
+		throw ucas::Error(ucas::strprintf("in GLCM(): unsupported number of levels %d", nlevels));
+
+	counts.resize(offsets.size());
+	matrices.resize(offsets.size());
+	marginals.resize(offsets.size());
+	descriptors.resize(offsets.size()*glcm_descriptors);
+	for(size_t k = 0; k < offsets.size(); k++)
+	{
+		counts[k].resize(size_t(nlevels)*nlevels);
+		matrices[k].create(nlevels, nlevels, CV_64F);
+		marginals[k].resize(nlevels);
+	}
+}
+
+void ucas::GLCM::compute(const cv::Mat & image, const cv::Mat & mask, bool parallel) throw (ucas::Error)
+{
+	// checks
+	if(!image.data)
+		throw ucas::Error("in GLCM::compute(): invalid image");
+	if(image.channels() != 1)
+		throw ucas::Error("in GLCM::compute(): unsupported number of channels");
+	if(image.depth() != CV_8U && image.depth() != CV_16U)
+		throw ucas::Error("in GLCM::compute(): unsupported bitdepth: only 8- and 16-bit grayscale image are supported");
+	if(mask.data && (mask.type() != CV_8UC1 || mask.size() != image.size()))
+		throw ucas::Error("in GLCM::compute(): mask must be an 8-bit single channel image of the same size");
+
+	// gray value -> level table, rebuilt only when the bitdepth changes
+	if(lut_depth != image.depth())
+	{
+		const int bits = image.depth() == CV_8U ? 8 : 16;
+		lut.resize(size_t(1) << bits);
+		for(size_t v = 0; v < lut.size(); v++)
+			lut[v] = int((v*nlevels) >> bits);
+		lut_depth = image.depth();
+	}
+
+	if(parallel && steps() > 1)
+		ucas::ThreadPool::global().parallel_for(interval<int>(steps()), [&](interval<int> r)
+		{
+			for(int k = r.start; k < r.end; k++)
+				computeStep(image, mask, k);
+		}, 1);
+	else
+		for(int k = 0; k < steps(); k++)
+			computeStep(image, mask, k);
+}
+
+double ucas::GLCM::meanDescriptor(glcmDescriptor d) const
+{
+	double sum = 0;
+	for(int k = 0; k < steps(); k++)
+		sum += descriptor(k, d);
+	return sum/steps();
+}
+
+void ucas::GLCM::computeStep(const cv::Mat & image, const cv::Mat & mask, int step)
+{
+	const int L = nlevels;
+	const int dx = offsets[step].x, dy = offsets[step].y;
+	std::vector<int> & C = counts[step];
+	std::fill(C.begin(), C.end(), 0);
+
+	// count pairs (p, p+d) with both pixels inside the image (and the mask)
+	const int y0 = std::max(0, -dy), y1 = std::min(image.rows, image.rows - dy);
+	const int x0 = std::max(0, -dx), x1 = std::min(image.cols, image.cols - dx);
+	double pairs = 0;
+	for(int y = y0; y < y1; y++)
+	{
+		const uchar * ma = mask.data ? mask.ptr<uchar>(y) : 0;
+		const uchar * mb = mask.data ? mask.ptr<uchar>(y + dy) + dx : 0;
+		int n = 0;
+		if(image.depth() == CV_8U)
+		{
+			const uchar * a = image.ptr<uchar>(y), * b = image.ptr<uchar>(y + dy) + dx;
+			for(int x = x0; x < x1; x++)
+				if(!ma || (ma[x] && mb[x]))
+				{
+					C[lut[a[x]]*L + lut[b[x]]]++;
+					n++;
+				}
+		}
+		else
+		{
+			const ushort * a = image.ptr<ushort>(y), * b = image.ptr<ushort>(y + dy) + dx;
+			for(int x = x0; x < x1; x++)
+				if(!ma || (ma[x] && mb[x]))
+				{
+					C[lut[a[x]]*L + lut[b[x]]]++;
+					n++;
+				}
+		}
+		pairs += n;
+	}
+
+	// symmetric normalized matrix P = (C + C') / 2N, and its marginal (the same for rows and columns)
+	cv::Mat & P = matrices[step];
+	std::vector<double> & px = marginals[step];
+	std::fill(px.begin(), px.end(), 0.0);
+	const double norm = pairs ? 0.5/pairs : 0.0;
+	for(int i = 0; i < L; i++)
+	{
+		double * Pi = P.ptr<double>(i);
+		for(int j = i; j < L; j++)
+		{
+			const double p = (C[i*L + j] + C[j*L + i])*norm;
+			Pi[j] = p;
+			P.at<double>(j, i) = p;
+		}
+	}
+
+	// first pass: everything that does not need the means
+	double entropy = 0, energy = 0, homogeneity = 0, contrast = 0, maxprob = 0;
+	for(int i = 0; i < L; i++)
+	{
+		const double * Pi = P.ptr<double>(i);
+		for(int j = 0; j < L; j++)
+		{
+			const double p = Pi[j];
+			if(p == 0)
+				continue;
+			const double d2 = double(i - j)*(i - j);
+			entropy -= p*std::log(p);
+			energy += p*p;
+			homogeneity += p/(1 + d2);
+			contrast += d2*p;
+			maxprob = std::max(maxprob, p);
+			px[i] += p;
+		}
+	}
+	double mu = 0, var = 0, hx = 0;
+	for(int i = 0; i < L; i++)
+	{
+		mu += i*px[i];
+		hx -= plogp(px[i]);
+	}
+	for(int i = 0; i < L; i++)
+		var += (i - mu)*(i - mu)*px[i];
+
+	// second pass: central moments and the information measures of correlation
+	double tendency = 0, shade = 0, covariance = 0, hxy1 = 0, hxy2 = 0;
+	for(int i = 0; i < L; i++)
+	{
+		const double * Pi = P.ptr<double>(i);
+		const double lpi = px[i] > 0 ? std::log(px[i]) : 0.0;
+		for(int j = 0; j < L; j++)
+		{
+			const double q = px[i]*px[j];
+			if(q == 0)
+				continue;
+			const double lq = lpi + std::log(px[j]);
+			hxy2 -= q*lq;
+			const double p = Pi[j];
+			if(p == 0)
+				continue;
+			const double s = i + j - 2*mu;
+			tendency += s*s*p;
+			shade += s*s*s*p;
+			covariance += (i - mu)*(j - mu)*p;
+			hxy1 -= p*lq;
+		}
+	}
+
+	double * D = &descriptors[step*glcm_descriptors];
+	D[glcm_entropy] = entropy;
+	D[glcm_energy] = energy;
+	D[glcm_homogeneity] = homogeneity;
+	D[glcm_contrast] = contrast;
+	D[glcm_clustertendency] = tendency;
+	D[glcm_clustershade] = shade;
+	D[glcm_correlation] = var > 0 ? covariance/var : 0.0;
+	D[glcm_correlationinfo1] = hx > 0 ? (entropy - hxy1)/hx : 0.0;
+	D[glcm_correlationinfo2] = std::sqrt(std::max(0.0, 1 - std::exp(-2*(hxy2 - entropy))));
+	D[glcm_maxprobability] = maxprob;
+}
@@ -0,0 +1,73 @@
+#ifndef _UCAS_TEXTURE_UTILS_H
+#define _UCAS_TEXTURE_UTILS_H
+
+#include <opencv2/core/core.hpp>
+#include "ucasExceptions.h"
+#include <vector>
+
+/*****************************************************************
+*   Gray-level co-occurrence matrix (GLCM) texture features      *
+******************************************************************/
+namespace ucas
+{
+	// Haralick descriptors, same set and order as the legacy CV_GLCMDESC_* ones
+	enum glcmDescriptor
+	{
+		glcm_entropy,									// -sum p(i,j) log p(i,j)
+		glcm_energy,									// sum p(i,j)^2
+		glcm_homogeneity,								// sum p(i,j) / (1 + (i-j)^2)
+		glcm_contrast,									// sum (i-j)^2 p(i,j)
+		glcm_clustertendency,							// sum (i+j-mux-muy)^2 p(i,j)
+		glcm_clustershade,								// sum (i+j-mux-muy)^3 p(i,j)
+		glcm_correlation,								// sum (i-mux)(j-muy) p(i,j) / (sigmax sigmay)
+		glcm_correlationinfo1,							// (HXY - HXY1) / max(HX, HY)
+		glcm_correlationinfo2,							// sqrt(1 - exp(-2 (HXY2 - HXY)))
+		glcm_maxprobability,							// max p(i,j)
+		glcm_descriptors								// number of descriptors
+	};
+
+	// Symmetric, normalized co-occurrence matrices of a grayscale image for a
+	// set of pixel offsets, with all the Haralick descriptors of each of them.
+	// Matrices, counters and the quantization table are kept across calls to
+	// compute(), so evaluating many images (thresholds, patches) of the same
+	// kind does not allocate. Offsets are processed concurrently.
+	class GLCM
+	{
+		public:
+
+			// 'offsets' are (dx, dy) displacements, 'levels' (2-1024) the number of gray levels the image is quantized to
+			GLCM(const std::vector<cv::Point> & offsets = defaultOffsets(), int levels = 256) throw (ucas::Error);
+
+			// build matrices and descriptors of 'image' (8- or 16-bit single channel, whose full range is quantized to
+			// 'levels' levels), counting only pairs with both pixels inside 'mask' (if given)
+			void compute(const cv::Mat & image, const cv::Mat & mask = cv::Mat(), bool parallel = true) throw (ucas::Error);
+
+			int steps() const { return int(offsets.size()); }
+			int levels() const { return nlevels; }
+
+			// normalized co-occurrence matrix of the given offset (levels x levels, CV_64F)
+			const cv::Mat & matrix(int step) const { return matrices[step]; }
+
+			// descriptor of the given offset, and its mean over all the offsets
+			double descriptor(int step, glcmDescriptor d) const { return descriptors[step*glcm_descriptors + d]; }
+			double meanDescriptor(glcmDescriptor d) const;
+
+			// right, up-right, up, up-left (the 4 legacy default step directions)
+			static std::vector<cv::Point> defaultOffsets();
+
+		private:
+
+			void computeStep(const cv::Mat & image, const cv::Mat & mask, int step);
+
+			std::vector<cv::Point> offsets;
+			int nlevels;
+			int lut_depth;								// depth the quantization table was built for (-1 = none)
+			std::vector<int> lut;						// gray value -> level
+			std::vector< std::vector<int> > counts;		// per-offset (non symmetric) pair counters
+			std::vector<cv::Mat> matrices;				// per-offset normalized symmetric matrices
+			std::vector< std::vector<double> > marginals;	// per-offset marginal probabilities
+			std::vector<double> descriptors;			// steps x glcm_descriptors
+	};
+}
+
+#endif